@@ -0,0 +1,233 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <arrow/api.h>
+#include <arrow/io/api.h>
+
+#ifdef USE_IO_URING
+#include <fcntl.h>
+#include <unistd.h>
+#include <liburing.h>
+
+/*
+ * Class to write a file with O_DIRECT through io_uring
+ *
+ * Data is gathered into queue_depth aligned buffers of buffer_size bytes.
+ * A full buffer is submitted at its file offset and the next free buffer is
+ * filled while it is in flight; only when every buffer is in flight does
+ * Write wait for the oldest completion. Close pads the last buffer to the
+ * block size and truncates the file back to its real length.
+ */
+class AsyncFileOutputStream : public arrow::io::OutputStream {
+  private:
+    static const int64_t ALIGNMENT = 4096;
+
+    int fd;
+    struct io_uring ring;
+    int64_t buffer_size;
+    std::vector<uint8_t*> buffers;
+    std::vector<int64_t> submitted;  // bytes submitted from each buffer
+    std::vector<int> free_buffers;
+    int current;          // buffer being filled, -1 when none
+    int64_t fill;         // bytes in the current buffer
+    int64_t file_offset;  // offset of the next submitted buffer
+    int in_flight;
+    bool is_closed;
+    std::string path;
+
+    AsyncFileOutputStream(int64_t buffer_size) :
+      fd(-1), buffer_size(buffer_size), current(-1), fill(0), file_offset(0), in_flight(0), is_closed(true)
+    { }
+
+    arrow::Status reap(bool wait) {
+      struct io_uring_cqe *cqe;
+      int rc = wait ? io_uring_wait_cqe(&ring, &cqe) : io_uring_peek_cqe(&ring, &cqe);
+      if (rc == -EAGAIN && !wait) {
+        return arrow::Status::OK();
+      }
+      if (rc < 0) {
+        return arrow::Status::IOError("io_uring wait on " + path + ": " + strerror(-rc));
+      }
+
+      int idx = (int) (intptr_t) io_uring_cqe_get_data(cqe);
+      int res = cqe->res;
+      io_uring_cqe_seen(&ring, cqe);
+      free_buffers.push_back(idx);
+      in_flight--;
+
+      if (res < 0) {
+        return arrow::Status::IOError("io_uring write to " + path + ": " + strerror(-res));
+      }
+      if (res != submitted[idx]) {
+        // O_DIRECT cannot resume at an unaligned offset, a short write is an error
+        return arrow::Status::IOError("io_uring short write to " + path + ": " + std::to_string(res) +
+                                      " of " + std::to_string(submitted[idx]) + " bytes");
+      }
+      return arrow::Status::OK();
+    }
+
+    arrow::Status submit(int64_t nbytes) {
+      struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+      if (!sqe) {
+        return arrow::Status::IOError("io_uring submission queue full for " + path);
+      }
+      io_uring_prep_write(sqe, fd, buffers[current], nbytes, file_offset);
+      io_uring_sqe_set_data(sqe, (void *) (intptr_t) current);
+      submitted[current] = nbytes;
+      int rc = io_uring_submit(&ring);
+      if (rc < 0) {
+        return arrow::Status::IOError("io_uring submit for " + path + ": " + strerror(-rc));
+      }
+
+      in_flight++;
+      file_offset += nbytes;
+      current = -1;
+      fill = 0;
+      return arrow::Status::OK();
+    }
+
+    arrow::Status drain() {
+      while (in_flight > 0) {
+        ARROW_RETURN_NOT_OK(reap(true));
+      }
+      return arrow::Status::OK();
+    }
+
+  public:
+    ~AsyncFileOutputStream() override {
+      Close();
+      for (uint8_t *buffer : buffers) {
+        free(buffer);
+      }
+    }
+
+    static arrow::Status Open(std::string path, std::shared_ptr<arrow::io::OutputStream> *out,
+                              int queue_depth=8, int64_t buffer_size=1 << 20) {
+      std::shared_ptr<AsyncFileOutputStream> stream(new AsyncFileOutputStream(buffer_size));
+      stream->path = path;
+
+      stream->fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+      if (stream->fd < 0) {
+        return arrow::Status::IOError("unable to open " + path + " with O_DIRECT: " + strerror(errno));
+      }
+      int rc = io_uring_queue_init(queue_depth, &stream->ring, 0);
+      if (rc < 0) {
+        close(stream->fd);
+        unlink(path.c_str());
+        return arrow::Status::IOError(std::string("io_uring setup: ") + strerror(-rc));
+      }
+      stream->is_closed = false;
+
+      for (int i=0; i<queue_depth; i++) {
+        void *buffer;
+        if (posix_memalign(&buffer, ALIGNMENT, buffer_size) != 0) {
+          return arrow::Status::OutOfMemory("unable to allocate aligned io buffers");
+        }
+        stream->buffers.push_back((uint8_t *) buffer);
+        stream->submitted.push_back(0);
+        stream->free_buffers.push_back(i);
+      }
+
+      *out = stream;
+      return arrow::Status::OK();
+    }
+
+    arrow::Status Write(const void *data, int64_t nbytes) override {
+      if (is_closed) {
+        return arrow::Status::IOError("write to closed " + path);
+      }
+
+      const uint8_t *src = (const uint8_t *) data;
+      while (nbytes > 0) {
+        if (current < 0) {
+          // take the next free buffer, waiting for one when all are in flight
+          if (free_buffers.empty()) {
+            ARROW_RETURN_NOT_OK(reap(true));
+          }
+          current = free_buffers.back();
+          free_buffers.pop_back();
+        }
+
+        int64_t n = std::min(nbytes, buffer_size - fill);
+        memcpy(buffers[current] + fill, src, n);
+        fill += n;
+        src += n;
+        nbytes -= n;
+
+        if (fill == buffer_size) {
+          ARROW_RETURN_NOT_OK(submit(buffer_size));
+          ARROW_RETURN_NOT_OK(reap(false));
+        }
+      }
+
+      return arrow::Status::OK();
+    }
+
+    // waits for the writes in flight, a partially filled buffer stays until Close
+    arrow::Status Flush() override {
+      return drain();
+    }
+
+    arrow::Status Tell(int64_t *position) const override {
+      *position = file_offset + fill;
+      return arrow::Status::OK();
+    }
+
+    bool closed() const override {
+      return is_closed;
+    }
+
+    arrow::Status Close() override {
+      if (is_closed) {
+        return arrow::Status::OK();
+      }
+      is_closed = true;
+
+      arrow::Status status;
+      int64_t size = file_offset + fill;
+      if (fill > 0) {
+        int64_t padded = (fill + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+        memset(buffers[current] + fill, 0, padded - fill);
+        status = submit(padded);
+      }
+      arrow::Status drained = drain();
+      if (status.ok()) {
+        status = drained;
+      }
+      if (status.ok() && ftruncate(fd, size) != 0) {
+        status = arrow::Status::IOError("unable to truncate " + path + ": " + strerror(errno));
+      }
+
+      io_uring_queue_exit(&ring);
+      if (close(fd) != 0 && status.ok()) {
+        status = arrow::Status::IOError("unable to close " + path + ": " + strerror(errno));
+      }
+      fd = -1;
+      return status;
+    }
+};
+#endif
+
+/*
+ * Function to open an output file, through io_uring and O_DIRECT when built
+ * with -DUSE_IO_URING and supported by the kernel and filesystem, otherwise
+ * as a regular arrow::io::FileOutputStream
+ */
+arrow::Status openOutputStream(std::string path, std::shared_ptr<arrow::io::OutputStream> *out) {
+#ifdef USE_IO_URING
+  if (AsyncFileOutputStream::Open(path, out).ok()) {
+    return arrow::Status::OK();
+  }
+#endif
+  std::shared_ptr<arrow::io::FileOutputStream> outfile;
+  ARROW_RETURN_NOT_OK(arrow::io::FileOutputStream::Open(path, &outfile));
+  *out = outfile;
+  return arrow::Status::OK();
+}
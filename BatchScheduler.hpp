@@ -0,0 +1,310 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <queue>
+#include <map>
+#include <functional>
+#include <algorithm>
+#include <pthread.h>
+#include <glob.h>
+#include <sys/stat.h>
+
+#include "CSVConverter.hpp"
+#include "MappedCSVReader.hpp"
+#include <arrow/api.h>
+#include <boost/algorithm/string.hpp>
+
+typedef std::function<arrow::Status(std::string, int64_t, int64_t, std::shared_ptr<arrow::Table>&)> batch_parse_fn_t;
+typedef std::function<arrow::Status(std::string, int64_t, std::vector<int64_t>*)> batch_split_fn_t;
+typedef std::function<arrow::Status(const std::shared_ptr<arrow::Table>&, std::string)> batch_write_fn_t;
+
+/*
+ * Batch input format:
+ *  <pattern>,<pattern>,...   glob patterns, e.g. "daily/*.csv"
+ *  @<listfile>               text file with one input path per line
+ */
+std::vector<std::string> expandBatchInputs(std::string inputs) {
+  std::vector<std::string> files;
+
+  if (!inputs.empty() && inputs[0] == '@') {
+    std::ifstream list(inputs.substr(1));
+    std::string line = "";
+    while (getline(list, line)) {
+      boost::trim(line);
+      if (!line.empty()) {
+        files.push_back(line);
+      }
+    }
+    return files;
+  }
+
+  std::vector<std::string> patterns;
+  boost::algorithm::split(patterns, inputs, boost::is_any_of(","));
+  for (std::string pattern : patterns) {
+    glob_t glob_result;
+    if (glob(pattern.c_str(), 0, NULL, &glob_result) == 0) {
+      for (size_t i=0; i<glob_result.gl_pathc; i++) {
+        files.push_back(glob_result.gl_pathv[i]);
+      }
+    } else {
+      std::cout << "No input matches: " << pattern << std::endl;
+    }
+    globfree(&glob_result);
+  }
+
+  return files;
+}
+
+enum batch_job_kind { BATCH_PARSE, BATCH_WRITE };
+
+struct batch_job {
+  batch_job_kind kind;
+  int64_t cost;                         // estimated input bytes
+  std::string name;                     // input path to parse or output name to write
+  std::shared_ptr<arrow::Table> table;  // table to write
+  std::string stem;                     // output name of the parts of the input, without the part number
+  int64_t begin;                        // byte range of the input to parse, end < 0 for the whole file
+  int64_t end;
+  int64_t part;
+};
+
+// writes drain first to release their tables, then the largest jobs run first
+struct batch_job_order {
+  bool operator()(const batch_job &a, const batch_job &b) const {
+    // true puts b above a
+    if (a.kind != b.kind) {
+      return b.kind == BATCH_WRITE;
+    }
+    return a.cost < b.cost;
+  }
+};
+
+/*
+ * Class to run a batch of conversions on one shared worker pool
+ *
+ * Every input file is a parse job. A file bigger than its fair share of the
+ * batch is cut at row boundaries into ranges, each parsed and written as its
+ * own part by any worker; small files are written as one part each or, when
+ * merging is enabled, concatenated with other tables of the same schema until
+ * merge_bytes is reached. Parts are named <output>_<index>_<stem>_<part>,
+ * index being the position of the input in the batch, so that inputs of the
+ * same name in different directories do not overwrite each other.
+ */
+class BatchScheduler {
+  private:
+    int num_workers;
+    batch_parse_fn_t parse_fn;
+    batch_split_fn_t split_fn;
+    batch_write_fn_t write_fn;
+    std::string output;
+    int64_t merge_bytes;
+    int64_t split_bytes;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    std::priority_queue<batch_job, std::vector<batch_job>, batch_job_order> jobs;
+    int running;
+    int parse_left;
+    int merge_count;
+    std::map<std::string, std::vector<std::shared_ptr<arrow::Table>>> merge_tables;
+    std::map<std::string, int64_t> merge_cost;
+    arrow::Status status;
+
+    static std::string fileStem(std::string path) {
+      size_t slash = path.find_last_of('/');
+      if (slash != std::string::npos) {
+        path = path.substr(slash + 1);
+      }
+      size_t dot = path.find_last_of('.');
+      return dot == std::string::npos ? path : path.substr(0, dot);
+    }
+
+    // caller holds the mutex
+    void flushMerged(std::string key) {
+      std::vector<std::shared_ptr<arrow::Table>> &tables = merge_tables[key];
+      if (tables.empty()) {
+        return;
+      }
+
+      batch_job job = {BATCH_WRITE, merge_cost[key], output + "_merged" + std::to_string(merge_count++), nullptr, "", 0, -1, 0};
+      arrow::Status st = arrow::ConcatenateTables(tables, &job.table);
+      if (!st.ok()) {
+        std::cout << "Error: unable to merge tables, " << st.ToString() << std::endl;
+        status = st;
+      } else {
+        jobs.push(job);
+      }
+
+      tables.clear();
+      merge_cost[key] = 0;
+    }
+
+    arrow::Status runParse(const batch_job &job) {
+      if (job.end < 0 && job.cost > split_bytes) {
+        // big file: cut into row ranges parsed and written in parallel
+        std::vector<int64_t> starts;
+        ARROW_RETURN_NOT_OK(split_fn(job.name, split_bytes, &starts));
+        if (starts.size() > 2) {
+          pthread_mutex_lock(&mutex);
+          for (size_t p=0; p+1<starts.size(); p++) {
+            jobs.push({BATCH_PARSE, starts[p+1] - starts[p], job.name, nullptr, job.stem,
+                       starts[p], starts[p+1], (int64_t) p});
+            parse_left++;
+          }
+          pthread_mutex_unlock(&mutex);
+          return arrow::Status::OK();
+        }
+      }
+
+      std::shared_ptr<arrow::Table> table;
+      ARROW_RETURN_NOT_OK(parse_fn(job.name, job.begin, job.end, table));
+
+      pthread_mutex_lock(&mutex);
+      if (job.end >= 0) {
+        // range of a big file, a part of its own
+        jobs.push({BATCH_WRITE, job.cost, job.stem + std::to_string(job.part), table, "", 0, -1, 0});
+      } else if (merge_bytes > 0) {
+        std::string key = table->schema()->ToString();
+        merge_tables[key].push_back(table);
+        merge_cost[key] += job.cost;
+        if (merge_cost[key] >= merge_bytes) {
+          flushMerged(key);
+        }
+      } else {
+        jobs.push({BATCH_WRITE, job.cost, job.stem + "0", table, "", 0, -1, 0});
+      }
+      pthread_mutex_unlock(&mutex);
+
+      return arrow::Status::OK();
+    }
+
+    void workLoop() {
+      pthread_mutex_lock(&mutex);
+      while (true) {
+        while (jobs.empty() && running > 0) {
+          pthread_cond_wait(&cond, &mutex);
+        }
+        if (jobs.empty()) {
+          break;
+        }
+
+        batch_job job = jobs.top();
+        jobs.pop();
+        running++;
+        pthread_mutex_unlock(&mutex);
+
+        arrow::Status st = (job.kind == BATCH_PARSE) ? runParse(job) : write_fn(job.table, job.name);
+        job.table.reset();
+
+        pthread_mutex_lock(&mutex);
+        if (!st.ok()) {
+          std::cout << "Error: " << job.name << ": " << st.ToString() << std::endl;
+          status = st;
+        }
+        if (job.kind == BATCH_PARSE && --parse_left == 0) {
+          // no more tables will arrive, write out what is left to merge
+          for (auto &entry : merge_tables) {
+            flushMerged(entry.first);
+          }
+        }
+        running--;
+        pthread_cond_broadcast(&cond);
+      }
+      pthread_mutex_unlock(&mutex);
+    }
+
+    static void *Worker(void *arg) {
+      ((BatchScheduler *) arg)->workLoop();
+      pthread_exit(NULL);
+    }
+
+  public:
+    BatchScheduler(int num_workers, batch_parse_fn_t parse_fn, batch_split_fn_t split_fn, batch_write_fn_t write_fn,
+                   std::string output, int64_t merge_bytes=0) :
+      num_workers(std::max(num_workers, 1)), parse_fn(parse_fn), split_fn(split_fn), write_fn(write_fn),
+      output(output), merge_bytes(merge_bytes), split_bytes(0),
+      running(0), parse_left(0), merge_count(0)
+    {
+      pthread_mutex_init(&mutex, NULL);
+      pthread_cond_init(&cond, NULL);
+    }
+
+    ~BatchScheduler() {
+      pthread_mutex_destroy(&mutex);
+      pthread_cond_destroy(&cond);
+    }
+
+    arrow::Status run(std::vector<std::string> files) {
+      if (files.empty()) {
+        return arrow::Status::Invalid("no input files for batch");
+      }
+
+      int64_t total_bytes = 0;
+      for (size_t i=0; i<files.size(); i++) {
+        struct stat file_stat;
+        int64_t size = (stat(files[i].c_str(), &file_stat) == 0) ? file_stat.st_size : 0;
+        total_bytes += size;
+        std::string stem = output + "_" + std::to_string(i) + "_" + fileStem(files[i]) + "_";
+        jobs.push({BATCH_PARSE, size, files[i], nullptr, stem, 0, -1, 0});
+        parse_left++;
+      }
+      split_bytes = std::max<int64_t>(total_bytes / num_workers, 1 << 20);
+      std::cout << "Batch: " << files.size() << " files, " << total_bytes << " bytes, "
+                << num_workers << " workers" << std::endl;
+
+      std::vector<pthread_t> thread_arr(num_workers);
+      int rc;
+      for (int t=0; t<num_workers; t++) {
+        rc = pthread_create(&thread_arr[t], NULL, Worker, (void *)this);
+        if (rc) {
+          std::cout << "Error:unable to create thread," << rc << std::endl;
+          exit(EXIT_FAILURE);
+        }
+      }
+      for (int t=0; t<num_workers; t++) {
+        rc = pthread_join(thread_arr[t], NULL);
+        if (rc) {
+          std::cout << "Error:unable to join, " << rc << std::endl;
+          exit(EXIT_FAILURE);
+        }
+      }
+
+      return status;
+    }
+};
+
+/*
+ * Function to convert every csv matched by inputs with the shared pool
+ *  merge_bytes: target size of merged outputs, 0 writes one output per input
+ */
+arrow::Status convertBatch(std::string inputs, std::string dataTypes, std::string output,
+                           int num_workers, int64_t merge_bytes, batch_write_fn_t write_fn) {
+  batch_parse_fn_t parse_fn = [dataTypes](std::string path, int64_t begin, int64_t end,
+                                          std::shared_ptr<arrow::Table> &table) {
+    return csvFileToColumnarTable(path, dataTypes, table, begin, end);
+  };
+  batch_split_fn_t split_fn = [](std::string path, int64_t part_bytes, std::vector<int64_t> *starts) {
+    MappedCSVReader reader(path);
+    ARROW_RETURN_NOT_OK(reader.open());
+    return reader.splitRows(part_bytes, starts);
+  };
+
+  BatchScheduler scheduler(num_workers, parse_fn, split_fn, write_fn, output, merge_bytes);
+  return scheduler.run(expandBatchInputs(inputs));
+}
+
+/*
+ * Function to read the merge target in MB, "--merge" alone means 128 MB
+ */
+int64_t parseMergeBytes(const std::map<std::string, std::string> &options) {
+  auto it = options.find("merge");
+  if (it == options.end()) {
+    return 0;
+  }
+  int64_t merge_mb = it->second.empty() ? 128 : boost::lexical_cast<int64_t>(it->second);
+  return merge_mb << 20;
+}
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <cstdint>
+#include <cassert>
+#include <iostream>
+#include <vector>
+#include <tuple>
+#include <map>
+#include <memory>
+
+#include "CSVReader.hpp"
+#include "ColumnStats.hpp"
+#include <arrow/api.h>
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+
+using arrow::Int32Builder;
+using arrow::FloatBuilder;
+using arrow::DoubleBuilder;
+using arrow::StringBuilder;
+using arrow::BooleanBuilder;
+
+typedef std::tuple<std::string,std::shared_ptr<arrow::DataType>> data_type_tup_t;
+
+/*
+ * Function to build a table from csv rows, optionally collecting the
+ * statistics of every column in the same pass into stats
+ */
+arrow::Status csvToColumnarTable(
+  const std::vector<std::vector<std::string>> &csvData,
+  const std::vector<data_type_tup_t> &dataTypeVec,
+  std::shared_ptr<arrow::Table> &table,
+  arrow::MemoryPool *pool = arrow::default_memory_pool(),
+  std::vector<ColumnStats> *stats = nullptr) {
+
+  // make schema
+  std::vector<std::shared_ptr<arrow::Field>> schema_vector;
+  // determine the builders
+  std::vector<std::unique_ptr<arrow::ArrayBuilder>> builders;
+  for (data_type_tup_t type : dataTypeVec) {
+    std::string first = std::get<0>(type);
+    std::shared_ptr<arrow::DataType> second = std::get<1>(type);
+    boost::trim(first);
+
+    if (second->Equals(arrow::int32())) {
+      schema_vector.push_back(arrow::field(first, arrow::int32()));
+      builders.emplace_back(new Int32Builder(pool));
+    } else if (second->Equals(arrow::float32())) {
+      builders.emplace_back(new FloatBuilder(pool));
+      schema_vector.push_back(arrow::field(first, arrow::float32()));
+    } else if (second->Equals(arrow::float64())) {
+      builders.emplace_back(new DoubleBuilder(pool));
+      schema_vector.push_back(arrow::field(first, arrow::float64()));
+    } else if (second->Equals(arrow::utf8())) {
+      builders.emplace_back(new StringBuilder(pool));
+      schema_vector.push_back(arrow::field(first, arrow::utf8()));
+    } else if (second->Equals(arrow::boolean())) {
+      builders.emplace_back(new BooleanBuilder(pool));
+      schema_vector.push_back(arrow::field(first, arrow::boolean()));
+    }
+  }
+
+  // prepare string -> bool map
+  std::map<std::string, bool> str_bool_map = {
+    {"true", true}, {"false", false},
+    {"True", true}, {"False", false},
+    {"TRUE", true}, {"FALSE", false},
+    {"T", true}, {"F", false},
+    {"1", true}, {"0", false}
+  };
+
+  for (const std::vector<std::string> &row : csvData) {
+    int builderLen = builders.size();
+    for (int i=0; i<builderLen; i++) {
+      std::shared_ptr<arrow::DataType> dataType = std::get<1>(dataTypeVec.at(i));
+      ColumnStats *colStats = stats ? &stats->at(i) : nullptr;
+      std::string col = row.at(i);
+      boost::trim(col);
+
+      // an empty field is null, except for strings where it is the empty string
+      if (col.empty() && !dataType->Equals(arrow::utf8())) {
+        arrow::ArrayBuilder *builder = builders.at(i).get();
+        if (dataType->Equals(arrow::int32())) {
+          ARROW_RETURN_NOT_OK(dynamic_cast<Int32Builder*>(builder)->AppendNull());
+        } else if (dataType->Equals(arrow::float32())) {
+          ARROW_RETURN_NOT_OK(dynamic_cast<FloatBuilder*>(builder)->AppendNull());
+        } else if (dataType->Equals(arrow::float64())) {
+          ARROW_RETURN_NOT_OK(dynamic_cast<DoubleBuilder*>(builder)->AppendNull());
+        } else if (dataType->Equals(arrow::boolean())) {
+          ARROW_RETURN_NOT_OK(dynamic_cast<BooleanBuilder*>(builder)->AppendNull());
+        }
+        if (colStats) colStats->addNull();
+        continue;
+      }
+
+      if (dataType->Equals(arrow::int32())) {
+        int value = boost::lexical_cast<int>(col);
+        ARROW_RETURN_NOT_OK(dynamic_cast<Int32Builder*>( builders.at(i).get() )->Append(value));
+        if (colStats) colStats->addInt(value);
+      } else if (dataType->Equals(arrow::float32())) {
+        float value = boost::lexical_cast<float>(col);
+        ARROW_RETURN_NOT_OK(dynamic_cast<FloatBuilder*>( builders.at(i).get() )->Append(value));
+        if (colStats) colStats->addDouble(value);
+      } else if (dataType->Equals(arrow::float64())) {
+        double value = boost::lexical_cast<double>(col);
+        ARROW_RETURN_NOT_OK(dynamic_cast<DoubleBuilder*>( builders.at(i).get() )->Append(value));
+        if (colStats) colStats->addDouble(value);
+      } else if (dataType->Equals(arrow::utf8())) {
+        ARROW_RETURN_NOT_OK(dynamic_cast<StringBuilder*>( builders.at(i).get() )->Append(col));
+        if (colStats) colStats->addString(col);
+      } else if (dataType->Equals(arrow::boolean())) {
+        bool value = str_bool_map.find(col)->second;
+        ARROW_RETURN_NOT_OK(dynamic_cast<BooleanBuilder*>( builders.at(i).get() )->Append(value));
+        if (colStats) colStats->addBool(value);
+      }
+    }
+  }
+
+  // finalise arrays, declare schema and combine to arrays
+  arrow::ArrayVector arrVector;
+  for (std::unique_ptr<arrow::ArrayBuilder> &builder : builders) {
+    std::shared_ptr<arrow::Array> arr;
+    ARROW_RETURN_NOT_OK(builder->Finish(&arr));
+    arrVector.push_back(arr);
+  }
+
+  auto schema = std::make_shared<arrow::Schema>(schema_vector);
+  table = arrow::Table::Make(schema, arrVector);
+
+  return arrow::Status::OK();
+}
+
+void printOutTable(const std::shared_ptr<arrow::Table> &table) {
+  int num_col = table->num_columns();
+
+  // print cols name
+  for (int i=0; i<num_col; i++) {
+    std::string col_name = table->column(i)->name();
+    std::cout << col_name << std::endl;
+
+    std::shared_ptr<arrow::ChunkedArray> col_chunked_array = table->GetColumnByName(col_name)->data();
+    int num_chunk = col_chunked_array->num_chunks();
+    std::cout << "Num chunk: " << num_chunk << std::endl;
+    for (int j=0; j<num_chunk; j++) {
+      std::cout << col_chunked_array->chunk(j)->ToString() << std::endl;
+    }
+    std::cout << std::endl;
+  }
+
+  std::cout << "done" << std::endl;
+}
+
+/*
+ * Data Types file format:
+ *  <type>, <type>, <type>
+ *
+ * supported data type:
+ *  - integer
+ *  - float
+ *  - double
+ *  - string
+ *  - boolean
+ */
+std::vector<data_type_tup_t> parseDataTypeString(std::string dataTypes, std::vector<std::string> header) {
+  std::vector<std::string> vec;
+  boost::algorithm::split(vec, dataTypes, boost::is_any_of(","));
+
+  assert(vec.size() == header.size());
+  std::vector<data_type_tup_t> dataTypeVec;
+  int headerLen = header.size();
+  for (int i=0; i<headerLen; i++) {
+    std::string type = vec.at(i);
+    std::string col_name = header.at(i);
+    if (type.compare("integer") == 0) {
+      dataTypeVec.push_back(std::make_tuple(col_name, arrow::int32()));
+    } else if (type.compare("float") == 0) {
+      dataTypeVec.push_back(std::make_tuple(col_name, arrow::float32()));
+    } else if (type.compare("double") == 0) {
+      dataTypeVec.push_back(std::make_tuple(col_name, arrow::float64()));
+    } else if (type.compare("string") == 0) {
+      dataTypeVec.push_back(std::make_tuple(col_name, arrow::utf8()));
+    } else if (type.compare("boolean") == 0) {
+      dataTypeVec.push_back(std::make_tuple(col_name, arrow::boolean()));
+    }
+  }
+
+  return dataTypeVec;
+}
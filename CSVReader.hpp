@@ -1,3 +1,5 @@
+#pragma once
+
 #include <iostream>
 #include <fstream>
 #include <vector>
@@ -12,10 +14,16 @@ class CSVReader {
   private:
     std::string filename;
     std::string delimeter;
+
+    // state of getDataChunk
+    std::ifstream chunk_file;
+    int chunk_num_col;
+    bool pending_valid;
+    std::vector<std::string> pending;
   
   public:
     CSVReader(std::string filename, std::string delm=",") :
-      filename(filename), delimeter(delm) 
+      filename(filename), delimeter(delm), chunk_num_col(-1), pending_valid(false)
     { }
 
     // function to fetch data from a CSV file
@@ -58,6 +66,55 @@ class CSVReader {
       return dataList;
     }
 
+    // function to fetch up to max_rows data rows, continuing where the previous call stopped.
+    // The last row read is held back until the next line shows whether it continues that row.
+    bool getDataChunk(size_t max_rows, std::vector<std::vector<std::string>> &dataList) {
+      dataList.clear();
+      std::string line = "";
+      if (chunk_num_col < 0) {
+        chunk_file.open(filename);
+        getline(chunk_file, line);  // dump the first row (header)
+        std::vector<std::string> header_vec;
+        boost::algorithm::split(header_vec, line, boost::is_any_of(delimeter));
+        chunk_num_col = header_vec.size();
+      }
+
+      while (dataList.size() < max_rows && getline(chunk_file, line)) {
+        std::vector<std::string> vec;
+        boost::algorithm::split(vec, line, boost::is_any_of(delimeter));
+        int vec_len = vec.size();
+        if (vec_len == 1 && pending_valid) {   // corner case: newline on last column
+          pending.back().append("\n");
+          pending.back().append(vec.back());
+          continue;
+        }
+        while (vec_len < chunk_num_col && getline(chunk_file, line)) { // new line in one col
+          std::vector<std::string> vec_extra;
+          boost::algorithm::split(vec_extra, line, boost::is_any_of(delimeter));
+
+          vec.back().append("\n");
+          vec.back().append(vec_extra.at(0));
+
+          vec_extra.erase( vec_extra.begin() );
+          vec.insert(vec.end(), vec_extra.begin(), vec_extra.end());
+          vec_len += vec_extra.size();
+        }
+
+        if (pending_valid) {
+          dataList.push_back(std::move(pending));
+        }
+        pending = std::move(vec);
+        pending_valid = true;
+      }
+
+      if (dataList.size() < max_rows && pending_valid) {  // end of file
+        dataList.push_back(std::move(pending));
+        pending_valid = false;
+      }
+
+      return !dataList.empty();
+    }
+
     // function to get csv header
     std::vector<std::string> getHeader() {
       std::ifstream file(filename);
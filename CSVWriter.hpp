@@ -0,0 +1,198 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <map>
+#include <pthread.h>
+
+#include <arrow/api.h>
+#include <arrow/io/api.h>
+
+// rows formatted at a time by CSVWriter::writeTable
+static const int64_t CSV_WRITE_CHUNK_ROWS = 1 << 16;
+
+/*
+ * Class to format record batches as csv text
+ */
+class CSVWriter {
+  private:
+    std::string delimeter;
+
+  public:
+    CSVWriter(std::string delm=",") :
+      delimeter(delm)
+    { }
+
+    // function to format the header row of schema
+    std::string formatHeader(const std::shared_ptr<arrow::Schema> &schema) {
+      std::string header = "";
+      int num_field = schema->num_fields();
+      for (int i=0; i<num_field; i++) {
+        header.append(schema->field(i)->name());
+        header.append(i != num_field-1 ? delimeter : "\n");
+      }
+      return header;
+    }
+
+    // function to format the rows of recordBatch, appended to out
+    arrow::Status formatRecordBatch(const std::shared_ptr<arrow::RecordBatch> &recordBatch, std::string *out) {
+      int64_t num_row = recordBatch->num_rows(), num_col = recordBatch->num_columns();
+      for (int64_t j=0; j<num_col; j++) {
+        arrow::Type::type type_id = recordBatch->column(j)->type_id();
+        if (type_id != arrow::Type::INT32 && type_id != arrow::Type::INT64 &&
+            type_id != arrow::Type::FLOAT && type_id != arrow::Type::DOUBLE &&
+            type_id != arrow::Type::STRING && type_id != arrow::Type::BOOL) {
+          return arrow::Status::NotImplemented("csv export of column " + recordBatch->column_name(j) +
+                                               " with type " + recordBatch->column(j)->type()->ToString());
+        }
+      }
+
+      // prepare bool -> string map
+      std::map<bool, std::string> bool_str_map = {
+        {true, "true"}, {false, "false"}
+      };
+
+      std::ostringstream outcsv;
+      outcsv << std::fixed;
+      for (int64_t i=0; i<num_row; i++) {
+        for (int64_t j=0; j<num_col; j++) {
+          const arrow::Array *col_arr = recordBatch->column(j).get();
+          if (col_arr->IsValid(i)) {
+            switch (col_arr->type_id()) {
+              case arrow::Type::INT32:
+                outcsv << static_cast<const arrow::Int32Array*>(col_arr)->Value(i);
+                break;
+              case arrow::Type::INT64:
+                outcsv << static_cast<const arrow::Int64Array*>(col_arr)->Value(i);
+                break;
+              case arrow::Type::FLOAT:
+                outcsv << static_cast<const arrow::FloatArray*>(col_arr)->Value(i);
+                break;
+              case arrow::Type::DOUBLE:
+                outcsv << static_cast<const arrow::DoubleArray*>(col_arr)->Value(i);
+                break;
+              case arrow::Type::STRING:
+                outcsv << static_cast<const arrow::StringArray*>(col_arr)->GetString(i);
+                break;
+              case arrow::Type::BOOL:
+                outcsv << bool_str_map.find(static_cast<const arrow::BooleanArray*>(col_arr)->Value(i))->second;
+                break;
+              default:
+                break;
+            }
+          }
+          if (j < num_col-1) {
+            outcsv << delimeter;
+          } else {
+            outcsv << "\n";
+          }
+        }
+      }
+      out->append(outcsv.str());
+
+      return arrow::Status::OK();
+    }
+
+    // function to format every record batch of table, appended to out
+    arrow::Status formatTable(const std::shared_ptr<arrow::Table> &table, std::string *out) {
+      arrow::TableBatchReader tableBatchReader(*table);
+      std::shared_ptr<arrow::RecordBatch> recordBatch;
+      while (true) {
+        ARROW_RETURN_NOT_OK(tableBatchReader.ReadNext(&recordBatch));
+        if (!recordBatch) {
+          break;
+        }
+        ARROW_RETURN_NOT_OK(formatRecordBatch(recordBatch, out));
+      }
+      return arrow::Status::OK();
+    }
+
+    // function to write the header and rows of table to out, formatting chunk_rows rows at a time
+    arrow::Status writeTable(const std::shared_ptr<arrow::Table> &table, arrow::io::OutputStream *out,
+                             int64_t chunk_rows = CSV_WRITE_CHUNK_ROWS) {
+      std::string text = formatHeader(table->schema());
+      ARROW_RETURN_NOT_OK(out->Write(text.data(), text.size()));
+
+      arrow::TableBatchReader tableBatchReader(*table);
+      tableBatchReader.set_chunksize(chunk_rows);
+      std::shared_ptr<arrow::RecordBatch> recordBatch;
+      while (true) {
+        ARROW_RETURN_NOT_OK(tableBatchReader.ReadNext(&recordBatch));
+        if (!recordBatch) {
+          break;
+        }
+        text.clear();
+        ARROW_RETURN_NOT_OK(formatRecordBatch(recordBatch, &text));
+        ARROW_RETURN_NOT_OK(out->Write(text.data(), text.size()));
+      }
+      return arrow::Status::OK();
+    }
+};
+
+/*
+ * Class to write pieces formatted by several threads in piece order
+ *
+ * A thread takes the next piece index with nextPiece() and hands back its
+ * text with commit(). At most window pieces are taken but not yet written,
+ * which bounds the memory held by finished pieces waiting for their turn.
+ */
+class OrderedCSVOutput {
+  private:
+    arrow::io::OutputStream *out;
+    arrow::Status status;
+    int64_t num_piece;
+    int64_t window;
+    int64_t next_take;
+    int64_t next_write;
+    std::map<int64_t, std::string> finished;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+
+  public:
+    OrderedCSVOutput(arrow::io::OutputStream *out, int64_t num_piece, int64_t window) :
+      out(out), num_piece(num_piece), window(window), next_take(0), next_write(0)
+    {
+      pthread_mutex_init(&mutex, NULL);
+      pthread_cond_init(&cond, NULL);
+    }
+
+    ~OrderedCSVOutput() {
+      pthread_mutex_destroy(&mutex);
+      pthread_cond_destroy(&cond);
+    }
+
+    // function to take the next piece, -1 when all pieces are taken
+    int64_t nextPiece() {
+      pthread_mutex_lock(&mutex);
+      while (next_take < num_piece && next_take >= next_write + window) {
+        pthread_cond_wait(&cond, &mutex);
+      }
+      int64_t piece = next_take < num_piece ? next_take++ : -1;
+      pthread_mutex_unlock(&mutex);
+      return piece;
+    }
+
+    // function to hand back the text of piece, written once its turn comes
+    void commit(int64_t piece, std::string text) {
+      pthread_mutex_lock(&mutex);
+      finished[piece].swap(text);
+      while (!finished.empty() && finished.begin()->first == next_write) {
+        const std::string &piece_text = finished.begin()->second;
+        if (status.ok()) {
+          status = out->Write(piece_text.data(), piece_text.size());
+        }
+        finished.erase(finished.begin());
+        next_write++;
+      }
+      pthread_cond_broadcast(&cond);
+      pthread_mutex_unlock(&mutex);
+    }
+
+    // function to get the first write error, once every piece is committed
+    arrow::Status getStatus() const {
+      return status;
+    }
+};
@@ -0,0 +1,291 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <tuple>
+#include <algorithm>
+
+#include <arrow/api.h>
+#include <boost/algorithm/string.hpp>
+
+// HyperLogLog precision, 2^12 registers give about 1.6% standard error
+static const int HLL_PRECISION = 12;
+// string length histogram buckets: 0, 1, 2-3, 4-7, ..., >= 2^16
+static const int LENGTH_BUCKETS = 18;
+
+// 64 bit finalizer of MurmurHash3, spreads every input bit over the hash
+inline uint64_t hashMix(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+inline uint64_t hashBytes(const char *data, size_t size) {
+  uint64_t h = 0xcbf29ce484222325ULL;  // FNV-1a
+  for (size_t i=0; i<size; i++) {
+    h = (h ^ (uint8_t) data[i]) * 0x100000001b3ULL;
+  }
+  return hashMix(h);
+}
+
+/*
+ * Class to collect the statistics of one column while it is parsed
+ *
+ * min/max, null count, an approximate distinct count (HyperLogLog) and, for
+ * strings, a histogram of value lengths in power of two buckets. Stats of
+ * chunks parsed separately are combined with merge().
+ */
+class ColumnStats {
+  private:
+    std::string name;
+    arrow::Type::type type_id;
+    int64_t count;
+    int64_t null_count;
+    bool has_value;
+    int64_t min_int, max_int;
+    double min_double, max_double;
+    std::string min_string, max_string;
+    std::vector<uint8_t> registers;
+    std::vector<int64_t> length_hist;
+
+    void addHash(uint64_t h) {
+      int idx = h >> (64 - HLL_PRECISION);
+      uint64_t rest = h << HLL_PRECISION;
+      uint8_t rank = rest == 0 ? (64 - HLL_PRECISION + 1) : __builtin_clzll(rest) + 1;
+      if (rank > registers[idx]) {
+        registers[idx] = rank;
+      }
+    }
+
+    static std::string escapeJSON(const std::string &s) {
+      std::string out = "\"";
+      for (char c : s) {
+        switch (c) {
+          case '"': out += "\\\""; break;
+          case '\\': out += "\\\\"; break;
+          case '\n': out += "\\n"; break;
+          case '\r': out += "\\r"; break;
+          case '\t': out += "\\t"; break;
+          default:
+            if ((unsigned char) c < 0x20) {
+              char buf[8];
+              snprintf(buf, sizeof(buf), "\\u%04x", c);
+              out += buf;
+            } else {
+              out += c;
+            }
+        }
+      }
+      return out + "\"";
+    }
+
+    // function to format a double as json, non-finite values as quoted strings
+    static std::string doubleJSON(double v) {
+      if (std::isnan(v)) {
+        return "\"NaN\"";
+      }
+      if (std::isinf(v)) {
+        return v > 0 ? "\"Infinity\"" : "\"-Infinity\"";
+      }
+      std::ostringstream json;
+      json.precision(17);
+      json << v;
+      return json.str();
+    }
+
+  public:
+    ColumnStats(std::string name, std::shared_ptr<arrow::DataType> type) :
+      name(name), type_id(type->id()), count(0), null_count(0), has_value(false),
+      min_int(0), max_int(0), min_double(0), max_double(0),
+      registers(1 << HLL_PRECISION, 0), length_hist(LENGTH_BUCKETS, 0)
+    { }
+
+    void addNull() {
+      count++;
+      null_count++;
+    }
+
+    void addInt(int64_t v) {
+      count++;
+      if (!has_value || v < min_int) min_int = v;
+      if (!has_value || v > max_int) max_int = v;
+      has_value = true;
+      addHash(hashMix((uint64_t) v));
+    }
+
+    void addDouble(double v) {
+      count++;
+      // NaN has no order, it is left out of min/max
+      if (!std::isnan(v)) {
+        if (!has_value || v < min_double) min_double = v;
+        if (!has_value || v > max_double) max_double = v;
+        has_value = true;
+      }
+      uint64_t bits;
+      memcpy(&bits, &v, sizeof(bits));
+      addHash(hashMix(bits));
+    }
+
+    void addBool(bool v) {
+      addInt(v ? 1 : 0);
+    }
+
+    void addString(const char *data, size_t size) {
+      count++;
+      if (!has_value || min_string.compare(0, std::string::npos, data, size) > 0) min_string.assign(data, size);
+      if (!has_value || max_string.compare(0, std::string::npos, data, size) < 0) max_string.assign(data, size);
+      has_value = true;
+      addHash(hashBytes(data, size));
+
+      int bucket = size == 0 ? 0 : 64 - __builtin_clzll((uint64_t) size);
+      length_hist[std::min(bucket, LENGTH_BUCKETS - 1)]++;
+    }
+
+    void addString(const std::string &v) {
+      addString(v.data(), v.size());
+    }
+
+    // function to combine the stats of another chunk of the same column
+    void merge(const ColumnStats &other) {
+      if (other.has_value) {
+        if (!has_value || other.min_int < min_int) min_int = other.min_int;
+        if (!has_value || other.max_int > max_int) max_int = other.max_int;
+        if (!has_value || other.min_double < min_double) min_double = other.min_double;
+        if (!has_value || other.max_double > max_double) max_double = other.max_double;
+        if (!has_value || other.min_string < min_string) min_string = other.min_string;
+        if (!has_value || other.max_string > max_string) max_string = other.max_string;
+        has_value = true;
+      }
+      count += other.count;
+      null_count += other.null_count;
+      for (size_t i=0; i<registers.size(); i++) {
+        registers[i] = std::max(registers[i], other.registers[i]);
+      }
+      for (int i=0; i<LENGTH_BUCKETS; i++) {
+        length_hist[i] += other.length_hist[i];
+      }
+    }
+
+    // function to estimate the distinct non-null values
+    int64_t distinctCount() const {
+      double m = registers.size(), sum = 0;
+      int zeros = 0;
+      for (uint8_t r : registers) {
+        sum += std::ldexp(1.0, -r);
+        zeros += (r == 0);
+      }
+      double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+      if (estimate <= 2.5 * m && zeros > 0) {
+        estimate = m * std::log(m / zeros);  // small range correction
+      }
+      return std::min<int64_t>(std::llround(estimate), count - null_count);
+    }
+
+    // dictionary encoding pays off when values repeat on average
+    bool preferDictionary() const {
+      int64_t values = count - null_count;
+      return values > 0 && distinctCount() * 2 <= values;
+    }
+
+    std::string getName() const {
+      return name;
+    }
+
+    std::string toJSON() const {
+      std::ostringstream json;
+      json.precision(17);
+      json << "{\"name\": " << escapeJSON(name)
+           << ", \"count\": " << count
+           << ", \"null_count\": " << null_count
+           << ", \"distinct_count\": " << distinctCount();
+      if (has_value) {
+        switch (type_id) {
+          case arrow::Type::INT32:
+            json << ", \"min\": " << min_int << ", \"max\": " << max_int;
+            break;
+          case arrow::Type::BOOL:
+            json << ", \"min\": " << (min_int ? "true" : "false") << ", \"max\": " << (max_int ? "true" : "false");
+            break;
+          case arrow::Type::FLOAT:
+          case arrow::Type::DOUBLE:
+            json << ", \"min\": " << doubleJSON(min_double) << ", \"max\": " << doubleJSON(max_double);
+            break;
+          case arrow::Type::STRING:
+            json << ", \"min\": " << escapeJSON(min_string) << ", \"max\": " << escapeJSON(max_string);
+            break;
+          default:
+            break;
+        }
+      }
+      if (type_id == arrow::Type::STRING) {
+        json << ", \"length_histogram\": {";
+        bool first = true;
+        for (int i=0; i<LENGTH_BUCKETS; i++) {
+          if (length_hist[i] == 0) {
+            continue;
+          }
+          int64_t lo = i == 0 ? 0 : (1LL << (i - 1)), hi = (1LL << i) - 1;
+          std::string bucket = i == 0 ? "0" : (i == LENGTH_BUCKETS - 1 ? std::to_string(lo) + "+" :
+                               (lo == hi ? std::to_string(lo) : std::to_string(lo) + "-" + std::to_string(hi)));
+          json << (first ? "" : ", ") << "\"" << bucket << "\": " << length_hist[i];
+          first = false;
+        }
+        json << "}";
+      }
+      json << ", \"encoding\": \"" << (preferDictionary() ? "dictionary" : "plain") << "\"}";
+      return json.str();
+    }
+};
+
+/*
+ * Function to make empty stats for every column of dataTypeVec-like (name, type) pairs
+ */
+template <typename TupVec>
+std::vector<ColumnStats> makeColumnStats(const TupVec &dataTypeVec) {
+  std::vector<ColumnStats> stats;
+  for (const auto &type : dataTypeVec) {
+    std::string name = std::get<0>(type);
+    boost::trim(name);
+    stats.push_back(ColumnStats(name, std::get<1>(type)));
+  }
+  return stats;
+}
+
+/*
+ * Function to merge the stats of one chunk into total
+ */
+void mergeColumnStats(std::vector<ColumnStats> &total, const std::vector<ColumnStats> &chunk) {
+  for (size_t i=0; i<total.size() && i<chunk.size(); i++) {
+    total[i].merge(chunk[i]);
+  }
+}
+
+std::string columnStatsToJSON(const std::vector<ColumnStats> &stats) {
+  std::string json = "{\"columns\": [\n";
+  for (size_t i=0; i<stats.size(); i++) {
+    json += "  " + stats[i].toJSON() + (i + 1 < stats.size() ? ",\n" : "\n");
+  }
+  return json + "]}\n";
+}
+
+/*
+ * Function to write the stats as a JSON sidecar next to the outputs
+ */
+arrow::Status writeColumnStatsSidecar(std::string path, const std::vector<ColumnStats> &stats) {
+  std::ofstream out(path);
+  if (!out.is_open()) {
+    return arrow::Status::IOError("unable to open " + path);
+  }
+  out << columnStatsToJSON(stats);
+  out.close();
+  return arrow::Status::OK();
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <map>
+
+/*
+ * Optional arguments following the positional ones:
+ *  --<name> <value>
+ *  --<name>            (flag, stored with an empty value)
+ */
+std::map<std::string, std::string> parseOptions(int argc, char **argv, int first) {
+  std::map<std::string, std::string> options;
+  for (int i=first; i<argc; i++) {
+    std::string arg = argv[i];
+    if (arg.compare(0, 2, "--") != 0) {
+      std::cout << "Ignoring unknown argument: " << arg << std::endl;
+      continue;
+    }
+
+    std::string name = arg.substr(2), value = "";
+    if (i+1 < argc && std::string(argv[i+1]).compare(0, 2, "--") != 0) {
+      value = argv[++i];
+    }
+    options[name] = value;
+  }
+
+  return options;
+}
+
+bool hasOption(const std::map<std::string, std::string> &options, std::string name) {
+  return options.find(name) != options.end();
+}
@@ -0,0 +1,247 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "CSVConverter.hpp"
+#include "MappedCSVReader.hpp"
+#include <arrow/api.h>
+#include <arrow/io/api.h>
+#include <arrow/ipc/api.h>
+
+// rows per record batch streamed to a sink
+static const size_t STREAM_CHUNK_ROWS = 1 << 16;
+
+/*
+ * Class to hand record batches to a consumer as soon as they are parsed
+ */
+class RecordBatchSink {
+  public:
+    virtual ~RecordBatchSink() { }
+    virtual arrow::Status open(const std::shared_ptr<arrow::Schema> &schema) = 0;
+    virtual arrow::Status write(const std::shared_ptr<arrow::RecordBatch> &batch) = 0;
+    virtual arrow::Status close() = 0;
+};
+
+/*
+ * Class to write the batches as one Arrow IPC stream to stdout ("-"), a pipe or a file
+ */
+class IPCStreamSink : public RecordBatchSink {
+  private:
+    std::string path;
+    std::shared_ptr<arrow::io::FileOutputStream> out;
+    std::shared_ptr<arrow::ipc::RecordBatchWriter> writer;
+
+  public:
+    IPCStreamSink(std::string path) : path(path) { }
+
+    arrow::Status open(const std::shared_ptr<arrow::Schema> &schema) override {
+      if (path == "-") {
+        ARROW_RETURN_NOT_OK(arrow::io::FileOutputStream::Open(STDOUT_FILENO, &out));
+      } else {
+        ARROW_RETURN_NOT_OK(arrow::io::FileOutputStream::Open(path, &out));
+      }
+      return arrow::ipc::RecordBatchStreamWriter::Open(out.get(), schema, &writer);
+    }
+
+    arrow::Status write(const std::shared_ptr<arrow::RecordBatch> &batch) override {
+      return writer->WriteRecordBatch(*batch);
+    }
+
+    arrow::Status close() override {
+      ARROW_RETURN_NOT_OK(writer->Close());
+      return out->Close();
+    }
+};
+
+/*
+ * Function to write one batch as a complete IPC stream: schema, batch, end of stream
+ */
+arrow::Status writeBatchStream(const std::shared_ptr<arrow::RecordBatch> &batch, arrow::io::OutputStream *out) {
+  std::shared_ptr<arrow::ipc::RecordBatchWriter> writer;
+  ARROW_RETURN_NOT_OK(arrow::ipc::RecordBatchStreamWriter::Open(out, batch->schema(), &writer));
+  ARROW_RETURN_NOT_OK(writer->WriteRecordBatch(*batch));
+  return writer->Close();
+}
+
+/*
+ * Class to place every batch in its own shared memory file and announce it
+ * over a unix socket
+ *
+ * open() listens on socket_path and waits for one consumer. Every batch is
+ * written as a complete IPC stream to <shm_dir>/arrow-csv-<pid>-<n>, sized
+ * exactly, then announced as a line "BATCH <path> <rows> <bytes>"; "END"
+ * follows the last one. The consumer maps the file, reads the batch without
+ * copying it and unlinks the file once done with it.
+ */
+class SharedMemorySink : public RecordBatchSink {
+  private:
+    std::string socket_path;
+    std::string shm_dir;
+    int listen_fd;
+    int conn_fd;
+    int64_t num_batch;
+
+    arrow::Status announce(std::string line) {
+      line += "\n";
+      size_t sent = 0;
+      while (sent < line.size()) {
+        ssize_t n = send(conn_fd, line.data() + sent, line.size() - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          return arrow::Status::IOError("unable to announce to the consumer: " + std::string(strerror(errno)));
+        }
+        sent += n;
+      }
+      return arrow::Status::OK();
+    }
+
+  public:
+    SharedMemorySink(std::string socket_path, std::string shm_dir) :
+      socket_path(socket_path), shm_dir(shm_dir), listen_fd(-1), conn_fd(-1), num_batch(0)
+    { }
+
+    ~SharedMemorySink() {
+      if (conn_fd >= 0) {
+        ::close(conn_fd);
+      }
+      if (listen_fd >= 0) {
+        ::close(listen_fd);
+        unlink(socket_path.c_str());
+      }
+    }
+
+    arrow::Status open(const std::shared_ptr<arrow::Schema> &schema) override {
+      struct sockaddr_un addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sun_family = AF_UNIX;
+      if (socket_path.size() >= sizeof(addr.sun_path)) {
+        return arrow::Status::Invalid("socket path too long: " + socket_path);
+      }
+      strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+
+      listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      unlink(socket_path.c_str());
+      if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(listen_fd, 1) < 0) {
+        return arrow::Status::IOError("unable to listen on " + socket_path + ": " + strerror(errno));
+      }
+      std::cout << "Waiting for a consumer on " << socket_path << std::endl;
+      while ((conn_fd = accept(listen_fd, NULL, NULL)) < 0) {
+        if (errno != EINTR) {
+          return arrow::Status::IOError("unable to accept on " + socket_path + ": " + strerror(errno));
+        }
+      }
+      return announce("SCHEMA " + std::to_string(schema->num_fields()));
+    }
+
+    arrow::Status write(const std::shared_ptr<arrow::RecordBatch> &batch) override {
+      // measure the stream first so that the shared memory file is sized exactly
+      arrow::io::MockOutputStream mock;
+      ARROW_RETURN_NOT_OK(writeBatchStream(batch, &mock));
+      int64_t size = mock.GetExtentBytesWritten();
+
+      std::string path = shm_dir + "/arrow-csv-" + std::to_string(getpid()) + "-" + std::to_string(num_batch++);
+      std::shared_ptr<arrow::io::MemoryMappedFile> shm;
+      ARROW_RETURN_NOT_OK(arrow::io::MemoryMappedFile::Create(path, size, &shm));
+      ARROW_RETURN_NOT_OK(writeBatchStream(batch, shm.get()));
+      ARROW_RETURN_NOT_OK(shm->Close());
+
+      return announce("BATCH " + path + " " + std::to_string(batch->num_rows()) + " " + std::to_string(size));
+    }
+
+    arrow::Status close() override {
+      return announce("END");
+    }
+};
+
+/*
+ * Function to tell whether the optional arguments from first ask for
+ * --ipc-stream to stdout ("-" or no path), before they are parsed so that
+ * main can move its messages to stderr ahead of any output
+ */
+bool streamsToStdout(int argc, char **argv, int first) {
+  for (int i=first; i<argc; i++) {
+    if (std::string(argv[i]) == "--ipc-stream") {
+      return i+1 >= argc || std::string(argv[i+1]) == "-" || std::string(argv[i+1]).compare(0, 2, "--") == 0;
+    }
+  }
+  return false;
+}
+
+/*
+ * Function to make the sink asked for by --ipc-stream <path>|- or --ipc-shm <socket>,
+ * nullptr when neither is given
+ */
+std::unique_ptr<RecordBatchSink> makeRecordBatchSink(const std::map<std::string, std::string> &options) {
+  auto it = options.find("ipc-stream");
+  if (it != options.end()) {
+    if (it->second.empty() || it->second == "-") {
+      return std::unique_ptr<RecordBatchSink>(new IPCStreamSink("-"));
+    }
+    return std::unique_ptr<RecordBatchSink>(new IPCStreamSink(it->second));
+  }
+  it = options.find("ipc-shm");
+  if (it != options.end()) {
+    auto dir = options.find("shm-dir");
+    return std::unique_ptr<RecordBatchSink>(new SharedMemorySink(it->second,
+                                                                 dir == options.end() ? "/dev/shm" : dir->second));
+  }
+  return nullptr;
+}
+
+/*
+ * Function to convert a csv in record batches of STREAM_CHUNK_ROWS rows,
+ * handing every batch to the sink as soon as it is parsed
+ */
+arrow::Status streamCSVToSink(std::string filename, std::string dataTypes, RecordBatchSink *sink) {
+  MappedCSVReader reader(filename);
+  ARROW_RETURN_NOT_OK(reader.open());
+  std::vector<data_type_tup_t> dataTypeVec = parseDataTypeString(dataTypes, reader.getHeader());
+  bool opened = false;
+  int64_t num_rows = 0, num_batch = 0;
+  while (true) {
+    std::shared_ptr<arrow::Table> table;
+    ARROW_RETURN_NOT_OK(reader.readTable(STREAM_CHUNK_ROWS, dataTypeVec, table));
+    if (!table) {
+      break;
+    }
+    if (!opened) {
+      ARROW_RETURN_NOT_OK(sink->open(table->schema()));
+      opened = true;
+    }
+
+    arrow::TableBatchReader tableBatchReader(*table);
+    std::shared_ptr<arrow::RecordBatch> recordBatch;
+    while (true) {
+      ARROW_RETURN_NOT_OK(tableBatchReader.ReadNext(&recordBatch));
+      if (!recordBatch) {
+        break;
+      }
+      ARROW_RETURN_NOT_OK(sink->write(recordBatch));
+      num_rows += recordBatch->num_rows();
+      num_batch++;
+    }
+  }
+
+  // an empty input still tells the consumer its schema
+  if (!opened) {
+    std::shared_ptr<arrow::Table> table;
+    ARROW_RETURN_NOT_OK(csvToColumnarTable({}, dataTypeVec, table));
+    ARROW_RETURN_NOT_OK(sink->open(table->schema()));
+  }
+  ARROW_RETURN_NOT_OK(sink->close());
+
+  std::cout << "Stream: " << num_rows << " rows in " << num_batch << " batches" << std::endl;
+  return arrow::Status::OK();
+}
@@ -0,0 +1,383 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cctype>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+
+#include "CSVReader.hpp"
+#include "CSVConverter.hpp"
+#include "ColumnStats.hpp"
+#include <arrow/api.h>
+#include <arrow/io/api.h>
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+
+// rows tokenized and built at a time when reading a whole file
+static const size_t MAPPED_CHUNK_ROWS = 1 << 16;
+
+/*
+ * Function to find the fields of up to max_rows csv rows of data[*position, size),
+ * following the row rules of CSVReader:
+ *  - a newline inside a row with fewer than num_col fields belongs to its last field
+ *  - a following line without any delimiter is appended to the last field of the row
+ * The begin/end offsets of the first num_col fields of every row are appended,
+ * missing fields as empty ones. Returns the number of rows found.
+ */
+size_t tokenizeRows(const char *data, int64_t size, char delimiter, int num_col, size_t max_rows,
+                    int64_t *position, std::vector<int64_t> *begins, std::vector<int64_t> *ends) {
+  int64_t p = *position;
+  size_t num_rows = 0;
+  while (num_rows < max_rows && p < size) {
+    int fields = 0;
+    int64_t field_start = p;
+    while (true) {
+      int64_t q = p;
+      while (q < size && data[q] != delimiter && data[q] != '\n') {
+        q++;
+      }
+      if (q < size && data[q] == delimiter) {
+        if (fields < num_col) {
+          begins->push_back(field_start);
+          ends->push_back(q);
+        }
+        fields++;
+        field_start = p = q + 1;
+        continue;
+      }
+      if (q < size && fields + 1 < num_col && q + 1 < size) {  // new line in one col
+        p = q + 1;
+        continue;
+      }
+      if (fields < num_col) {
+        begins->push_back(field_start);
+        ends->push_back(q);
+      }
+      fields++;
+      p = q < size ? q + 1 : size;
+      break;
+    }
+    for (; fields < num_col; fields++) {
+      begins->push_back(p);
+      ends->push_back(p);
+    }
+
+    // corner case: newline on last column, the line carries no delimiter
+    while (p < size) {
+      const char *line_end = (const char *) memchr(data + p, '\n', size - p);
+      int64_t e = line_end ? line_end - data : size;
+      if (memchr(data + p, delimiter, e - p) != NULL) {
+        break;
+      }
+      if (fields == num_col) {
+        ends->back() = e;
+      }
+      p = e < size ? e + 1 : size;
+    }
+    num_rows++;
+  }
+  *position = p;
+  return num_rows;
+}
+
+/*
+ * Class to read a csv file mapped in memory, building the columns straight
+ * from the mapped bytes
+ *
+ * Instead of copying every field into a std::string, rows are tokenized into
+ * field offsets, a chunk of rows at a time, and every column of the chunk is
+ * built in one pass over them: numbers are
+ * parsed in place, strings get their offsets computed in bulk and their bytes
+ * copied into a data buffer allocated once at its final size. Single column
+ * files and multi-character delimiters are read through CSVReader instead.
+ */
+class MappedCSVReader {
+  private:
+    std::string filename;
+    std::string delimeter;
+    std::shared_ptr<arrow::io::MemoryMappedFile> file;
+    std::shared_ptr<arrow::Buffer> data;
+    int64_t position;
+    int64_t limit;
+    int num_col;
+    bool fallback;
+    CSVReader reader;
+    std::vector<std::string> header;
+    std::vector<int64_t> begins;
+    std::vector<int64_t> ends;
+
+    // function to drop the surrounding spaces of field (row, c), as boost::trim does
+    void trimmedField(size_t row, int c, const char **value, int64_t *length) const {
+      const char *bytes = (const char *) data->data();
+      int64_t b = begins[row * num_col + c], e = ends[row * num_col + c];
+      while (b < e && isspace((unsigned char) bytes[b])) b++;
+      while (e > b && isspace((unsigned char) bytes[e - 1])) e--;
+      *value = bytes + b;
+      *length = e - b;
+    }
+
+    arrow::Status buildStringColumn(size_t num_rows, int c, arrow::MemoryPool *pool, ColumnStats *colStats,
+                                    std::shared_ptr<arrow::Array> *out) {
+      std::shared_ptr<arrow::Buffer> offsets;
+      ARROW_RETURN_NOT_OK(arrow::AllocateBuffer(pool, (num_rows + 1) * sizeof(int32_t), &offsets));
+      int32_t *offset = (int32_t *) offsets->mutable_data();
+      int64_t total = 0;
+      const char *value;
+      int64_t length;
+      for (size_t row=0; row<num_rows; row++) {
+        trimmedField(row, c, &value, &length);
+        offset[row] = total;
+        total += length;
+        if (total > std::numeric_limits<int32_t>::max()) {
+          return arrow::Status::CapacityError("string column " + std::to_string(c) + " over 2 GB in one chunk");
+        }
+      }
+      offset[num_rows] = total;
+
+      std::shared_ptr<arrow::Buffer> values;
+      ARROW_RETURN_NOT_OK(arrow::AllocateBuffer(pool, total, &values));
+      uint8_t *dest = values->mutable_data();
+      for (size_t row=0; row<num_rows; row++) {
+        trimmedField(row, c, &value, &length);
+        memcpy(dest + offset[row], value, length);
+        if (colStats) colStats->addString(value, length);
+      }
+
+      *out = std::make_shared<arrow::StringArray>(num_rows, offsets, values, nullptr, 0);
+      return arrow::Status::OK();
+    }
+
+    template <typename Builder, typename T>
+    arrow::Status buildNumericColumn(size_t num_rows, int c, arrow::MemoryPool *pool, ColumnStats *colStats,
+                                     std::shared_ptr<arrow::Array> *out) {
+      Builder builder(pool);
+      ARROW_RETURN_NOT_OK(builder.Reserve(num_rows));
+      const char *value;
+      int64_t length;
+      for (size_t row=0; row<num_rows; row++) {
+        trimmedField(row, c, &value, &length);
+        // an empty field is null
+        if (length == 0) {
+          ARROW_RETURN_NOT_OK(builder.AppendNull());
+          if (colStats) colStats->addNull();
+          continue;
+        }
+        T number;
+        try {
+          number = boost::lexical_cast<T>(value, length);
+        } catch (const boost::bad_lexical_cast &) {
+          return arrow::Status::Invalid("column " + boost::trim_copy(header[c]) + ": not a number: " + std::string(value, length));
+        }
+        ARROW_RETURN_NOT_OK(builder.Append(number));
+        if (colStats) {
+          if (std::is_integral<T>::value) colStats->addInt(number);
+          else colStats->addDouble(number);
+        }
+      }
+      return builder.Finish(out);
+    }
+
+    arrow::Status buildBooleanColumn(size_t num_rows, int c, arrow::MemoryPool *pool, ColumnStats *colStats,
+                                     std::shared_ptr<arrow::Array> *out) {
+      static const std::map<std::string, bool> str_bool_map = {
+        {"true", true}, {"false", false},
+        {"True", true}, {"False", false},
+        {"TRUE", true}, {"FALSE", false},
+        {"T", true}, {"F", false},
+        {"1", true}, {"0", false}
+      };
+      arrow::BooleanBuilder builder(pool);
+      ARROW_RETURN_NOT_OK(builder.Reserve(num_rows));
+      const char *value;
+      int64_t length;
+      for (size_t row=0; row<num_rows; row++) {
+        trimmedField(row, c, &value, &length);
+        if (length == 0) {
+          ARROW_RETURN_NOT_OK(builder.AppendNull());
+          if (colStats) colStats->addNull();
+          continue;
+        }
+        auto it = str_bool_map.find(std::string(value, length));
+        if (it == str_bool_map.end()) {
+          return arrow::Status::Invalid("column " + boost::trim_copy(header[c]) + ": not a boolean: " + std::string(value, length));
+        }
+        ARROW_RETURN_NOT_OK(builder.Append(it->second));
+        if (colStats) colStats->addBool(it->second);
+      }
+      return builder.Finish(out);
+    }
+
+  public:
+    MappedCSVReader(std::string filename, std::string delm=",") :
+      filename(filename), delimeter(delm), position(0), limit(0), num_col(0), fallback(false), reader(filename, delm)
+    { }
+
+    // function to map the file and read its header
+    arrow::Status open() {
+      ARROW_RETURN_NOT_OK(arrow::io::MemoryMappedFile::Open(filename, arrow::io::FileMode::READ, &file));
+      int64_t size;
+      ARROW_RETURN_NOT_OK(file->GetSize(&size));
+      ARROW_RETURN_NOT_OK(file->ReadAt(0, size, &data));  // no copy, a view of the mapping
+
+      const char *bytes = (const char *) data->data();
+      const char *line_end = size > 0 ? (const char *) memchr(bytes, '\n', size) : NULL;
+      std::string line(bytes, line_end ? line_end - bytes : size);
+      position = line_end ? line_end - bytes + 1 : size;
+      limit = size;
+      boost::algorithm::split(header, line, boost::is_any_of(delimeter));
+      std::cout << "header: " << line << std::endl;
+
+      num_col = header.size();
+      fallback = delimeter.size() != 1 || num_col < 2;
+      return arrow::Status::OK();
+    }
+
+    std::vector<std::string> getHeader() const {
+      return header;
+    }
+
+    /*
+     * Function to find row starts cutting the rows left in parts of about
+     * part_bytes each, the last start being the end of the data. Only the row
+     * boundaries are found, no column is built.
+     */
+    arrow::Status splitRows(int64_t part_bytes, std::vector<int64_t> *starts) {
+      starts->assign(1, position);
+      if (fallback) {
+        starts->push_back(limit);
+        return arrow::Status::OK();
+      }
+
+      int64_t p = position;
+      std::vector<int64_t> row_begins, row_ends;
+      while (p < limit) {
+        row_begins.clear();
+        row_ends.clear();
+        size_t num_rows = tokenizeRows((const char *) data->data(), limit, delimeter[0], num_col,
+                                       1 << 12, &p, &row_begins, &row_ends);
+        for (size_t row=0; row<num_rows; row++) {
+          // the first field of a row begins where the row does
+          int64_t start = row_begins[row * num_col];
+          if (start - starts->back() >= part_bytes) {
+            starts->push_back(start);
+          }
+        }
+      }
+      starts->push_back(limit);
+      return arrow::Status::OK();
+    }
+
+    int64_t remainingBytes() const {
+      return limit - position;
+    }
+
+    // function to estimate the rows left from the lines of up to the next 1 MB, without reading them
+    int64_t estimateRows() const {
+      int64_t left = limit - position;
+      int64_t sample = std::min<int64_t>(left, 1 << 20);
+      if (sample <= 0) {
+        return 0;
+      }
+      const char *bytes = (const char *) data->data() + position;
+      int64_t lines = std::count(bytes, bytes + sample, '\n');
+      return (lines + 1) * left / sample;
+    }
+
+    // function to read only the rows starting in [begin, end), both found by splitRows
+    void setRange(int64_t begin, int64_t end) {
+      position = begin;
+      limit = end;
+    }
+
+    // function to convert up to max_rows following rows, table is left null once none is left
+    arrow::Status readTable(size_t max_rows, const std::vector<data_type_tup_t> &dataTypeVec,
+                            std::shared_ptr<arrow::Table> &table, arrow::MemoryPool *pool = arrow::default_memory_pool(),
+                            std::vector<ColumnStats> *stats = nullptr) {
+      table.reset();
+      if (fallback) {
+        std::vector<std::vector<std::string>> csvData;
+        if (reader.getDataChunk(max_rows, csvData)) {
+          ARROW_RETURN_NOT_OK(csvToColumnarTable(csvData, dataTypeVec, table, pool, stats));
+        }
+        return arrow::Status::OK();
+      }
+
+      begins.clear();
+      ends.clear();
+      size_t num_rows = tokenizeRows((const char *) data->data(), limit, delimeter[0], num_col,
+                                     max_rows, &position, &begins, &ends);
+      if (num_rows == 0) {
+        return arrow::Status::OK();
+      }
+
+      std::vector<std::shared_ptr<arrow::Field>> schema_vector;
+      arrow::ArrayVector arrVector;
+      for (size_t i=0; i<dataTypeVec.size() && (int) i<num_col; i++) {
+        std::string name = std::get<0>(dataTypeVec.at(i));
+        std::shared_ptr<arrow::DataType> dataType = std::get<1>(dataTypeVec.at(i));
+        boost::trim(name);
+        ColumnStats *colStats = stats ? &stats->at(i) : nullptr;
+
+        std::shared_ptr<arrow::Array> arr;
+        if (dataType->Equals(arrow::int32())) {
+          ARROW_RETURN_NOT_OK((buildNumericColumn<arrow::Int32Builder, int>(num_rows, i, pool, colStats, &arr)));
+        } else if (dataType->Equals(arrow::float32())) {
+          ARROW_RETURN_NOT_OK((buildNumericColumn<arrow::FloatBuilder, float>(num_rows, i, pool, colStats, &arr)));
+        } else if (dataType->Equals(arrow::float64())) {
+          ARROW_RETURN_NOT_OK((buildNumericColumn<arrow::DoubleBuilder, double>(num_rows, i, pool, colStats, &arr)));
+        } else if (dataType->Equals(arrow::utf8())) {
+          ARROW_RETURN_NOT_OK(buildStringColumn(num_rows, i, pool, colStats, &arr));
+        } else if (dataType->Equals(arrow::boolean())) {
+          ARROW_RETURN_NOT_OK(buildBooleanColumn(num_rows, i, pool, colStats, &arr));
+        } else {
+          continue;
+        }
+        schema_vector.push_back(arrow::field(name, dataType));
+        arrVector.push_back(arr);
+      }
+
+      table = arrow::Table::Make(std::make_shared<arrow::Schema>(schema_vector), arrVector);
+      return arrow::Status::OK();
+    }
+
+    // function to convert every row left, MAPPED_CHUNK_ROWS at a time, into one table of those chunks
+    arrow::Status readAll(const std::vector<data_type_tup_t> &dataTypeVec, std::shared_ptr<arrow::Table> &table,
+                          arrow::MemoryPool *pool = arrow::default_memory_pool(),
+                          std::vector<ColumnStats> *stats = nullptr) {
+      std::vector<std::shared_ptr<arrow::Table>> chunks;
+      while (true) {
+        std::shared_ptr<arrow::Table> chunk;
+        ARROW_RETURN_NOT_OK(readTable(MAPPED_CHUNK_ROWS, dataTypeVec, chunk, pool, stats));
+        if (!chunk) {
+          break;
+        }
+        chunks.push_back(chunk);
+      }
+      if (chunks.empty()) {  // no rows, still the schema
+        return csvToColumnarTable({}, dataTypeVec, table, pool, stats);
+      }
+      return arrow::ConcatenateTables(chunks, &table);
+    }
+};
+
+/*
+ * Function to read a whole csv file, or the rows starting in [begin, end)
+ * when end is given, into a columnar table
+ */
+arrow::Status csvFileToColumnarTable(std::string filename, std::string dataTypes, std::shared_ptr<arrow::Table> &table,
+                                     int64_t begin = 0, int64_t end = -1) {
+  MappedCSVReader reader(filename);
+  ARROW_RETURN_NOT_OK(reader.open());
+  if (end >= 0) {
+    reader.setRange(begin, end);
+  }
+
+  std::vector<data_type_tup_t> dataTypeVec = parseDataTypeString(dataTypes, reader.getHeader());
+  return reader.readAll(dataTypeVec, table);
+}
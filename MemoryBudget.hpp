@@ -0,0 +1,902 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <queue>
+#include <memory>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "CSVConverter.hpp"
+#include "MappedCSVReader.hpp"
+#include "TableSorter.hpp"
+#include "TableDeduplicator.hpp"
+#include <arrow/api.h>
+#include <arrow/io/api.h>
+#include <arrow/ipc/api.h>
+
+// rows per record batch when converting within a memory budget
+static const size_t BUDGET_CHUNK_ROWS = 1 << 16;
+// rows per slice of a spilled batch, the unit a sorted run is merged in
+static const int64_t SPILL_SLICE_ROWS = 1 << 12;
+// sorted runs merged at once, each holding one spill file open
+static const size_t MERGE_FAN_IN = 64;
+
+/*
+ * Class to count the bytes allocated through it and refuse allocations past limit
+ */
+class TrackingMemoryPool : public arrow::MemoryPool {
+  private:
+    arrow::MemoryPool *pool;
+    int64_t limit;
+    std::atomic<int64_t> bytes;
+    std::atomic<int64_t> max_bytes;
+
+    void update(int64_t diff) {
+      int64_t now = bytes += diff;
+      int64_t prev = max_bytes.load();
+      while (now > prev && !max_bytes.compare_exchange_weak(prev, now)) { }
+    }
+
+  public:
+    TrackingMemoryPool(int64_t limit, arrow::MemoryPool *pool=arrow::default_memory_pool()) :
+      pool(pool), limit(limit), bytes(0), max_bytes(0)
+    { }
+
+    arrow::Status Allocate(int64_t size, uint8_t **out) override {
+      if (bytes.load() + size > limit) {
+        return arrow::Status::OutOfMemory("allocation of " + std::to_string(size) +
+                                          " bytes exceeds the memory limit of " + std::to_string(limit) + " bytes");
+      }
+      ARROW_RETURN_NOT_OK(pool->Allocate(size, out));
+      update(size);
+      return arrow::Status::OK();
+    }
+
+    arrow::Status Reallocate(int64_t old_size, int64_t new_size, uint8_t **ptr) override {
+      if (new_size > old_size && bytes.load() + new_size - old_size > limit) {
+        return arrow::Status::OutOfMemory("reallocation to " + std::to_string(new_size) +
+                                          " bytes exceeds the memory limit of " + std::to_string(limit) + " bytes");
+      }
+      ARROW_RETURN_NOT_OK(pool->Reallocate(old_size, new_size, ptr));
+      update(new_size - old_size);
+      return arrow::Status::OK();
+    }
+
+    void Free(uint8_t *buffer, int64_t size) override {
+      pool->Free(buffer, size);
+      update(-size);
+    }
+
+    int64_t bytes_allocated() const override {
+      return bytes.load();
+    }
+
+    int64_t max_memory() const override {
+      return max_bytes.load();
+    }
+};
+
+/*
+ * Function to sum the buffer sizes of a record batch
+ */
+int64_t recordBatchBytes(const std::shared_ptr<arrow::RecordBatch> &batch) {
+  int64_t size = 0;
+  for (int i=0; i<batch->num_columns(); i++) {
+    for (const std::shared_ptr<arrow::Buffer> &buffer : batch->column_data(i)->buffers) {
+      if (buffer) {
+        size += buffer->size();
+      }
+    }
+  }
+  return size;
+}
+
+/*
+ * Function to stitch batches of the same schema back into one batch
+ */
+arrow::Status concatenateBatches(const std::shared_ptr<arrow::Schema> &schema,
+                                 const std::vector<std::shared_ptr<arrow::RecordBatch>> &batches,
+                                 arrow::MemoryPool *pool, std::shared_ptr<arrow::RecordBatch> *out) {
+  if (batches.size() == 1) {
+    *out = batches[0];
+    return arrow::Status::OK();
+  }
+
+  arrow::ArrayVector columns;
+  int64_t num_rows = 0;
+  for (const std::shared_ptr<arrow::RecordBatch> &piece : batches) {
+    num_rows += piece->num_rows();
+  }
+  for (int c=0; c<schema->num_fields(); c++) {
+    arrow::ArrayVector pieces;
+    for (const std::shared_ptr<arrow::RecordBatch> &piece : batches) {
+      pieces.push_back(piece->column(c));
+    }
+    std::shared_ptr<arrow::Array> column;
+    ARROW_RETURN_NOT_OK(arrow::Concatenate(pieces, pool, &column));
+    columns.push_back(column);
+  }
+  *out = arrow::RecordBatch::Make(schema, num_rows, columns);
+  return arrow::Status::OK();
+}
+
+/*
+ * Class to read a record batch in slices of SPILL_SLICE_ROWS rows
+ */
+class SliceReader : public arrow::RecordBatchReader {
+  private:
+    std::shared_ptr<arrow::RecordBatch> batch;
+    int64_t offset;
+
+  public:
+    SliceReader(std::shared_ptr<arrow::RecordBatch> batch) :
+      batch(batch), offset(0)
+    { }
+
+    std::shared_ptr<arrow::Schema> schema() const override {
+      return batch->schema();
+    }
+
+    arrow::Status ReadNext(std::shared_ptr<arrow::RecordBatch> *out) override {
+      if (offset >= batch->num_rows()) {
+        out->reset();
+        return arrow::Status::OK();
+      }
+      *out = batch->Slice(offset, SPILL_SLICE_ROWS);
+      offset += SPILL_SLICE_ROWS;
+      return arrow::Status::OK();
+    }
+};
+
+/*
+ * Class to hold the record batches of a conversion within a memory budget
+ *
+ * Once the pool grows past spill_bytes, the oldest batches still in memory
+ * are written to temporary Arrow IPC files, in slices of SPILL_SLICE_ROWS,
+ * and dropped. take() hands a batch back as it is, or read back from its file
+ * when it was spilled; openRun() streams it back one slice at a time instead.
+ */
+class SpillBuffer {
+  private:
+    TrackingMemoryPool *pool;
+    int64_t spill_bytes;
+    std::string spill_dir;
+
+    std::shared_ptr<arrow::Schema> schema;
+    std::vector<std::shared_ptr<arrow::RecordBatch>> batches;  // null once spilled or taken
+    std::vector<std::string> spill_paths;                       // empty unless spilled
+    std::vector<int64_t> batch_bytes;
+    size_t next_spill;
+    int num_spilled;
+    pthread_mutex_t mutex;
+
+    // caller holds the mutex
+    arrow::Status spill(size_t i) {
+      std::string path = spill_dir + "/arrow-spill-XXXXXX";
+      int fd = mkstemp(&path[0]);
+      if (fd < 0) {
+        return arrow::Status::IOError("unable to create spill file in " + spill_dir);
+      }
+
+      std::shared_ptr<arrow::io::FileOutputStream> outfile;
+      ARROW_RETURN_NOT_OK(arrow::io::FileOutputStream::Open(fd, &outfile));
+      std::shared_ptr<arrow::ipc::RecordBatchWriter> writer;
+      ARROW_RETURN_NOT_OK(arrow::ipc::RecordBatchStreamWriter::Open(outfile.get(), schema, &writer));
+      for (int64_t offset=0; offset<batches[i]->num_rows(); offset+=SPILL_SLICE_ROWS) {
+        ARROW_RETURN_NOT_OK(writer->WriteRecordBatch(*batches[i]->Slice(offset, SPILL_SLICE_ROWS)));
+      }
+      ARROW_RETURN_NOT_OK(writer->Close());
+      ARROW_RETURN_NOT_OK(outfile->Close());
+
+      spill_paths[i] = path;
+      batches[i].reset();
+      num_spilled++;
+      return arrow::Status::OK();
+    }
+
+  public:
+    SpillBuffer(TrackingMemoryPool *pool, int64_t spill_bytes, std::string spill_dir) :
+      pool(pool), spill_bytes(spill_bytes), spill_dir(spill_dir), next_spill(0), num_spilled(0)
+    {
+      pthread_mutex_init(&mutex, NULL);
+    }
+
+    ~SpillBuffer() {
+      for (std::string path : spill_paths) {
+        if (!path.empty()) {
+          unlink(path.c_str());
+        }
+      }
+      pthread_mutex_destroy(&mutex);
+    }
+
+    // function to add a batch, spilling the oldest ones while over budget
+    arrow::Status append(const std::shared_ptr<arrow::RecordBatch> &batch) {
+      arrow::Status status;
+      pthread_mutex_lock(&mutex);
+      if (!schema) {
+        schema = batch->schema();
+      }
+      batches.push_back(batch);
+      spill_paths.push_back("");
+      batch_bytes.push_back(recordBatchBytes(batch));
+
+      while (status.ok() && pool->bytes_allocated() > spill_bytes && next_spill < batches.size()) {
+        if (batches[next_spill]) {
+          status = spill(next_spill);
+        }
+        next_spill++;
+      }
+      pthread_mutex_unlock(&mutex);
+      return status;
+    }
+
+    // function to stream batch i back in slices and release it from the buffer
+    arrow::Status openRun(size_t i, std::shared_ptr<arrow::RecordBatchReader> *out) {
+      pthread_mutex_lock(&mutex);
+      std::shared_ptr<arrow::RecordBatch> batch = batches[i];
+      batches[i].reset();
+      std::string path = spill_paths[i];
+      spill_paths[i] = "";
+      pthread_mutex_unlock(&mutex);
+
+      if (batch) {
+        *out = std::make_shared<SliceReader>(batch);
+        return arrow::Status::OK();
+      }
+      if (path.empty()) {
+        return arrow::Status::Invalid("batch " + std::to_string(i) + " was already taken");
+      }
+
+      // the open file keeps the data after the unlink
+      std::shared_ptr<arrow::io::ReadableFile> infile;
+      ARROW_RETURN_NOT_OK(arrow::io::ReadableFile::Open(path, pool, &infile));
+      unlink(path.c_str());
+      std::shared_ptr<arrow::RecordBatchReader> reader;
+      ARROW_RETURN_NOT_OK(arrow::ipc::RecordBatchStreamReader::Open(infile, &reader));
+      *out = reader;
+      return arrow::Status::OK();
+    }
+
+    // function to hand batch i back whole and release it from the buffer
+    arrow::Status take(size_t i, std::shared_ptr<arrow::RecordBatch> *out) {
+      pthread_mutex_lock(&mutex);
+      *out = batches[i];
+      batches[i].reset();
+      pthread_mutex_unlock(&mutex);
+      if (*out) {
+        return arrow::Status::OK();
+      }
+
+      // spilled: stitch its slices back together
+      std::shared_ptr<arrow::RecordBatchReader> reader;
+      ARROW_RETURN_NOT_OK(openRun(i, &reader));
+
+      std::vector<std::shared_ptr<arrow::RecordBatch>> slices;
+      std::shared_ptr<arrow::RecordBatch> slice;
+      while (true) {
+        ARROW_RETURN_NOT_OK(reader->ReadNext(&slice));
+        if (!slice) {
+          break;
+        }
+        slices.push_back(slice);
+      }
+      return concatenateBatches(reader->schema(), slices, pool, out);
+    }
+
+    size_t size() const { return batches.size(); }
+    int64_t bytes(size_t i) const { return batch_bytes[i]; }
+    int spilled() const { return num_spilled; }
+    std::shared_ptr<arrow::Schema> getSchema() const { return schema; }
+    TrackingMemoryPool *getPool() const { return pool; }
+};
+
+/*
+ * Class to stream batches [first, last) of a SpillBuffer back as one run,
+ * one slice at a time and with at most one spill file open
+ */
+class RunReader : public arrow::RecordBatchReader {
+  private:
+    SpillBuffer *buffer;
+    size_t next;
+    size_t last;
+    std::shared_ptr<arrow::RecordBatchReader> current;
+
+  public:
+    RunReader(SpillBuffer *buffer, size_t first, size_t last) :
+      buffer(buffer), next(first), last(last)
+    { }
+
+    std::shared_ptr<arrow::Schema> schema() const override {
+      return buffer->getSchema();
+    }
+
+    arrow::Status ReadNext(std::shared_ptr<arrow::RecordBatch> *out) override {
+      while (true) {
+        if (current) {
+          ARROW_RETURN_NOT_OK(current->ReadNext(out));
+          if (*out) {
+            return arrow::Status::OK();
+          }
+          current.reset();
+        }
+        if (next >= last) {
+          out->reset();
+          return arrow::Status::OK();
+        }
+        ARROW_RETURN_NOT_OK(buffer->openRun(next++, &current));
+      }
+    }
+};
+
+/*
+ * Function to append value row of array to a builder of the same type
+ */
+arrow::Status appendValue(arrow::ArrayBuilder *builder, const arrow::Array &array, int64_t row) {
+  switch (array.type_id()) {
+    case arrow::Type::INT32: {
+      arrow::Int32Builder *b = static_cast<arrow::Int32Builder*>(builder);
+      return array.IsNull(row) ? b->AppendNull() : b->Append(static_cast<const arrow::Int32Array&>(array).Value(row));
+    }
+    case arrow::Type::INT64: {
+      arrow::Int64Builder *b = static_cast<arrow::Int64Builder*>(builder);
+      return array.IsNull(row) ? b->AppendNull() : b->Append(static_cast<const arrow::Int64Array&>(array).Value(row));
+    }
+    case arrow::Type::FLOAT: {
+      arrow::FloatBuilder *b = static_cast<arrow::FloatBuilder*>(builder);
+      return array.IsNull(row) ? b->AppendNull() : b->Append(static_cast<const arrow::FloatArray&>(array).Value(row));
+    }
+    case arrow::Type::DOUBLE: {
+      arrow::DoubleBuilder *b = static_cast<arrow::DoubleBuilder*>(builder);
+      return array.IsNull(row) ? b->AppendNull() : b->Append(static_cast<const arrow::DoubleArray&>(array).Value(row));
+    }
+    case arrow::Type::STRING: {
+      arrow::StringBuilder *b = static_cast<arrow::StringBuilder*>(builder);
+      int32_t length;
+      const uint8_t *value = static_cast<const arrow::StringArray&>(array).GetValue(row, &length);
+      return array.IsNull(row) ? b->AppendNull() : b->Append(value, length);
+    }
+    case arrow::Type::BOOL: {
+      arrow::BooleanBuilder *b = static_cast<arrow::BooleanBuilder*>(builder);
+      return array.IsNull(row) ? b->AppendNull() : b->Append(static_cast<const arrow::BooleanArray&>(array).Value(row));
+    }
+    default:
+      return arrow::Status::NotImplemented("cannot merge column of type " + array.type()->ToString());
+  }
+}
+
+// cursor over one sorted run, at row of the current slice
+struct run_cursor {
+  size_t run;
+  std::shared_ptr<arrow::RecordBatchReader> reader;
+  std::shared_ptr<arrow::RecordBatch> slice;
+  std::vector<const arrow::Array*> keys;
+  int64_t row;
+};
+
+// orders the heap so that the smallest row is on top, ties by run to stay stable
+struct run_cursor_greater {
+  bool operator()(const run_cursor *x, const run_cursor *y) const {
+    int c = compareRows(x->keys, x->row, y->keys, y->row);
+    return c != 0 ? c > 0 : x->run > y->run;
+  }
+};
+
+/*
+ * Function to step a cursor to its next row, loading the next slice of the run when needed
+ * Returns false in *more once the run is exhausted
+ */
+arrow::Status advanceCursor(run_cursor *cursor, const std::vector<int> &key_indices, bool *more) {
+  cursor->row++;
+  while (!cursor->slice || cursor->row >= cursor->slice->num_rows()) {
+    ARROW_RETURN_NOT_OK(cursor->reader->ReadNext(&cursor->slice));
+    if (!cursor->slice) {
+      *more = false;
+      return arrow::Status::OK();
+    }
+    cursor->row = 0;
+    cursor->keys.clear();
+    for (int idx : key_indices) {
+      cursor->keys.push_back(cursor->slice->column(idx).get());
+    }
+  }
+  *more = true;
+  return arrow::Status::OK();
+}
+
+/*
+ * Function to merge sorted runs of buffer into out, in batches of BUDGET_CHUNK_ROWS rows
+ *  bounds: run r is batches [bounds[r], bounds[r+1]) of buffer, runs [first, last) are merged
+ *
+ * Only the current slice of every run is held in memory, spilled runs are
+ * streamed back from their files; the merged batches go to out, which
+ * spills in turn while over budget.
+ */
+arrow::Status mergeSortedRuns(SpillBuffer &buffer, const std::vector<size_t> &bounds, size_t first, size_t last,
+                              const std::vector<int> &key_indices, SpillBuffer &out) {
+  std::shared_ptr<arrow::Schema> schema = buffer.getSchema();
+  arrow::MemoryPool *pool = buffer.getPool();
+
+  std::vector<run_cursor> cursors(last - first);
+  std::priority_queue<run_cursor*, std::vector<run_cursor*>, run_cursor_greater> heap;
+  for (size_t r=0; r<cursors.size(); r++) {
+    cursors[r].run = r;
+    cursors[r].row = -1;
+    cursors[r].reader = std::make_shared<RunReader>(&buffer, bounds[first + r], bounds[first + r + 1]);
+    bool more;
+    ARROW_RETURN_NOT_OK(advanceCursor(&cursors[r], key_indices, &more));
+    if (more) {
+      heap.push(&cursors[r]);
+    }
+  }
+
+  std::vector<std::unique_ptr<arrow::ArrayBuilder>> builders(schema->num_fields());
+  for (int c=0; c<schema->num_fields(); c++) {
+    ARROW_RETURN_NOT_OK(arrow::MakeBuilder(pool, schema->field(c)->type(), &builders[c]));
+  }
+
+  size_t num_rows = 0;
+  while (!heap.empty()) {
+    run_cursor *cursor = heap.top();
+    heap.pop();
+    for (int c=0; c<schema->num_fields(); c++) {
+      ARROW_RETURN_NOT_OK(appendValue(builders[c].get(), *cursor->slice->column(c), cursor->row));
+    }
+    num_rows++;
+
+    bool more;
+    ARROW_RETURN_NOT_OK(advanceCursor(cursor, key_indices, &more));
+    if (more) {
+      heap.push(cursor);
+    }
+
+    if (num_rows == BUDGET_CHUNK_ROWS || (heap.empty() && num_rows > 0)) {
+      arrow::ArrayVector columns(schema->num_fields());
+      for (int c=0; c<schema->num_fields(); c++) {
+        ARROW_RETURN_NOT_OK(builders[c]->Finish(&columns[c]));
+      }
+      ARROW_RETURN_NOT_OK(out.append(arrow::RecordBatch::Make(schema, num_rows, columns)));
+      num_rows = 0;
+    }
+  }
+
+  return arrow::Status::OK();
+}
+
+/*
+ * Function to merge the sorted batches of buffer, each one run, into a single
+ * sorted run. At most MERGE_FAN_IN runs are merged at once, so that the open
+ * spill files stay bounded; larger inputs take several passes, every pass
+ * merging groups of runs into the runs of the next.
+ */
+arrow::Status mergeAllRuns(std::unique_ptr<SpillBuffer> &buffer, const std::vector<int> &key_indices,
+                           int64_t spill_bytes, std::string spill_dir, int *num_pass) {
+  std::vector<size_t> bounds;
+  for (size_t i=0; i<=buffer->size(); i++) {
+    bounds.push_back(i);
+  }
+  *num_pass = 0;
+  while (bounds.size() > 2) {
+    std::unique_ptr<SpillBuffer> merged(new SpillBuffer(buffer->getPool(), spill_bytes, spill_dir));
+    std::vector<size_t> merged_bounds = {0};
+    size_t num_run = bounds.size() - 1;
+    for (size_t first=0; first<num_run; first+=MERGE_FAN_IN) {
+      ARROW_RETURN_NOT_OK(mergeSortedRuns(*buffer, bounds, first, std::min(first + MERGE_FAN_IN, num_run),
+                                          key_indices, *merged));
+      merged_bounds.push_back(merged->size());
+    }
+    buffer.swap(merged);
+    bounds.swap(merged_bounds);
+    (*num_pass)++;
+  }
+  return arrow::Status::OK();
+}
+
+struct dedupe_partition_thread_args {
+  SpillBuffer *keys;
+  std::vector<std::vector<size_t>> *partitions;  // batches of keys in each partition
+  std::atomic<size_t> *next_partition;
+  std::vector<uint8_t> *duplicate;  // by ordinal
+  bool keep_last;
+  int64_t num_dup;
+  arrow::Status status;
+};
+
+/*
+ * Function to deduplicate key partitions until none is left, marking the
+ * ordinals of the duplicate rows
+ */
+void *DedupePartitions(void *threadarg) {
+  struct dedupe_partition_thread_args *args;
+  args = (struct dedupe_partition_thread_args *) threadarg;
+
+  size_t p;
+  while (args->status.ok() && (p = (*args->next_partition)++) < args->partitions->size()) {
+    if (args->partitions->at(p).empty()) {
+      continue;
+    }
+    std::vector<std::shared_ptr<arrow::RecordBatch>> batches;
+    for (size_t i : args->partitions->at(p)) {
+      std::shared_ptr<arrow::RecordBatch> batch;
+      args->status = args->keys->take(i, &batch);
+      if (!args->status.ok()) {
+        break;
+      }
+      batches.push_back(batch);
+    }
+    std::shared_ptr<arrow::RecordBatch> partition;
+    if (args->status.ok()) {
+      args->status = concatenateBatches(batches[0]->schema(), batches, args->keys->getPool(), &partition);
+    }
+    if (!args->status.ok()) {
+      break;
+    }
+    batches.clear();
+
+    // key columns first, the ordinal last
+    int num_key = partition->num_columns() - 1;
+    std::vector<const arrow::Array*> keys;
+    for (int k=0; k<num_key; k++) {
+      keys.push_back(partition->column(k).get());
+    }
+    std::vector<uint64_t> hashes(partition->num_rows());
+    std::vector<int64_t> rows(partition->num_rows());
+    for (int64_t row=0; row<partition->num_rows(); row++) {
+      hashes[row] = hashKeyRow(keys, row);
+      rows[row] = row;
+    }
+    std::vector<uint8_t> duplicate(partition->num_rows(), 0);
+    args->num_dup += markDuplicateRows(keys, hashes, rows, args->keep_last, &duplicate);
+
+    const arrow::Int64Array *ordinals = static_cast<const arrow::Int64Array*>(partition->column(num_key).get());
+    for (int64_t row=0; row<partition->num_rows(); row++) {
+      if (duplicate[row]) {
+        (*args->duplicate)[ordinals->Value(row)] = 1;
+      }
+    }
+  }
+
+  pthread_exit(NULL);
+}
+
+/*
+ * Class to gather the key batches of every hash partition before they go to a
+ * SpillBuffer, so that every batch it holds, and spills to a file of its own,
+ * carries a useful number of rows
+ *
+ * The pending batches of a partition are stitched into one and appended once
+ * they reach flush_bytes. Every partition is flushed while the pending total
+ * is over max_pending_bytes, and by finish().
+ */
+class KeyPartitionBuffer {
+  private:
+    SpillBuffer *keys;
+    std::vector<std::vector<size_t>> *partitions;  // batches of keys in each partition
+    int64_t flush_bytes;
+    int64_t max_pending_bytes;
+    int64_t total_pending;
+    std::vector<std::vector<std::shared_ptr<arrow::RecordBatch>>> pending;
+    std::vector<int64_t> pending_bytes;
+
+    arrow::Status flush(size_t p) {
+      if (pending[p].empty()) {
+        return arrow::Status::OK();
+      }
+      std::shared_ptr<arrow::RecordBatch> batch;
+      ARROW_RETURN_NOT_OK(concatenateBatches(pending[p][0]->schema(), pending[p], keys->getPool(), &batch));
+      pending[p].clear();
+      total_pending -= pending_bytes[p];
+      pending_bytes[p] = 0;
+      (*partitions)[p].push_back(keys->size());
+      return keys->append(batch);
+    }
+
+  public:
+    KeyPartitionBuffer(SpillBuffer *keys, std::vector<std::vector<size_t>> *partitions,
+                       int64_t flush_bytes, int64_t max_pending_bytes) :
+      keys(keys), partitions(partitions), flush_bytes(flush_bytes), max_pending_bytes(max_pending_bytes),
+      total_pending(0), pending(partitions->size()), pending_bytes(partitions->size(), 0)
+    { }
+
+    arrow::Status append(size_t p, const std::shared_ptr<arrow::RecordBatch> &batch) {
+      int64_t bytes = recordBatchBytes(batch);
+      pending[p].push_back(batch);
+      pending_bytes[p] += bytes;
+      total_pending += bytes;
+      if (pending_bytes[p] >= flush_bytes) {
+        ARROW_RETURN_NOT_OK(flush(p));
+      }
+      if (total_pending > max_pending_bytes) {
+        return finish();
+      }
+      return arrow::Status::OK();
+    }
+
+    // function to flush every partition
+    arrow::Status finish() {
+      for (size_t p=0; p<pending.size(); p++) {
+        ARROW_RETURN_NOT_OK(flush(p));
+      }
+      return arrow::Status::OK();
+    }
+};
+
+// writes batches [first, last) of the buffer as output part <name>
+typedef std::function<arrow::Status(std::string, SpillBuffer&, size_t, size_t)> part_write_fn_t;
+
+struct budget_part {
+  std::string name;
+  size_t first;
+  size_t last;
+};
+
+struct write_part_thread_args {
+  std::vector<budget_part> *parts;
+  std::atomic<size_t> *next_part;
+  SpillBuffer *buffer;
+  part_write_fn_t *write_fn;
+  arrow::Status status;
+};
+
+/*
+ * Function to write parts until none is left
+ */
+void *WriteParts(void *threadarg) {
+  struct write_part_thread_args *args;
+  args = (struct write_part_thread_args *) threadarg;
+
+  size_t p;
+  while (args->status.ok() && (p = (*args->next_part)++) < args->parts->size()) {
+    budget_part &part = args->parts->at(p);
+    args->status = (*args->write_fn)(part.name, *args->buffer, part.first, part.last);
+  }
+
+  pthread_exit(NULL);
+}
+
+/*
+ * Function to convert a csv in record batches of BUDGET_CHUNK_ROWS rows held
+ * in a SpillBuffer, then write them as output parts with factor threads
+ *  limit_bytes: allocations past it fail, spilling starts at 3/4 of it
+ *  max_part_bytes: upper bound of a part for writers that hold a whole part, 0 for none
+ *  stats: when given, filled with the column stats of the whole input before the parts are written
+ *  sort_by: when given, "<col>,<col>" to sort the whole input by; every batch is sorted
+ *           as it is parsed, then the sorted batches are merged as runs of an external sort
+ *  dedupe_on: when given, "<col>,<col>" whose repeated keys are dropped, keeping the first
+ *             row (last when keep_last). The key columns of every batch are hash-partitioned
+ *             into a second spill buffer as they are parsed, then the partitions are
+ *             deduplicated by factor threads and the duplicates dropped before any write.
+ *  single_part: when true, every batch goes to one part, written by one call of write_fn
+ */
+arrow::Status convertWithinBudget(std::string filename, std::string dataTypes, std::string output, int factor,
+                                  int64_t limit_bytes, int64_t max_part_bytes, std::string spill_dir,
+                                  part_write_fn_t write_fn, std::vector<ColumnStats> *stats=nullptr,
+                                  std::string sort_by="", std::string dedupe_on="", bool keep_last=false,
+                                  bool single_part=false) {
+  TrackingMemoryPool pool(limit_bytes);
+  std::unique_ptr<SpillBuffer> buffer(new SpillBuffer(&pool, limit_bytes / 4 * 3, spill_dir));
+  std::vector<int> key_indices;
+  if (factor < 1) {
+    factor = 1;
+  }
+
+  // read and convert chunk by chunk
+  MappedCSVReader reader(filename);
+  ARROW_RETURN_NOT_OK(reader.open());
+
+  // size partitions so that factor of them fit in a quarter of the budget: their keys,
+  // at most the input size, and DEDUPE_ROW_BYTES for every row while deduplicating
+  SpillBuffer keyBuffer(&pool, limit_bytes / 4 * 3, spill_dir);
+  std::vector<int> dedupe_indices;
+  size_t num_partition = factor;
+  if (!dedupe_on.empty()) {
+    int64_t partition_bytes = std::max<int64_t>(limit_bytes / (4 * factor), 1);
+    int64_t dedupe_bytes = reader.remainingBytes() + reader.estimateRows() * DEDUPE_ROW_BYTES;
+    num_partition = std::min<size_t>(std::max<size_t>(num_partition, dedupe_bytes / partition_bytes + 1), 4096);
+  }
+  std::vector<std::vector<size_t>> partitions(num_partition);
+  // an eighth of the budget for the key rows waiting for their partition to fill up
+  KeyPartitionBuffer keyPartitions(&keyBuffer, &partitions,
+                                   std::max<int64_t>(limit_bytes / 8 / num_partition, 1 << 16), limit_bytes / 8);
+  int64_t num_row = 0;
+
+  std::vector<data_type_tup_t> dataTypeVec = parseDataTypeString(dataTypes, reader.getHeader());
+  if (stats) {
+    *stats = makeColumnStats(dataTypeVec);
+  }
+  int64_t total_bytes = 0;
+  while (true) {
+    std::shared_ptr<arrow::Table> table;
+    std::vector<ColumnStats> chunkStats = makeColumnStats(dataTypeVec);
+    ARROW_RETURN_NOT_OK(reader.readTable(BUDGET_CHUNK_ROWS, dataTypeVec, table, &pool, stats ? &chunkStats : nullptr));
+    if (!table) {
+      break;
+    }
+    if (stats) {
+      mergeColumnStats(*stats, chunkStats);
+    }
+
+    arrow::TableBatchReader tableBatchReader(*table);
+    std::shared_ptr<arrow::RecordBatch> recordBatch;
+    ARROW_RETURN_NOT_OK(tableBatchReader.ReadNext(&recordBatch));
+    table.reset();
+    if (!dedupe_on.empty()) {
+      if (dedupe_indices.empty()) {
+        ARROW_RETURN_NOT_OK(resolveKeyColumns(recordBatch->schema(), dedupe_on, &dedupe_indices));
+      }
+      std::vector<std::shared_ptr<arrow::RecordBatch>> keyBatches;
+      ARROW_RETURN_NOT_OK(partitionKeys(recordBatch, dedupe_indices, num_row, num_partition, &pool, &keyBatches));
+      for (size_t p=0; p<num_partition; p++) {
+        if (keyBatches[p]) {
+          ARROW_RETURN_NOT_OK(keyPartitions.append(p, keyBatches[p]));
+        }
+      }
+    }
+    num_row += recordBatch->num_rows();
+    // with dedupe, batches are sorted once their duplicates are dropped
+    if (!sort_by.empty() && dedupe_on.empty()) {
+      if (key_indices.empty()) {
+        ARROW_RETURN_NOT_OK(resolveKeyColumns(recordBatch->schema(), sort_by, &key_indices));
+      }
+      ARROW_RETURN_NOT_OK(sortRecordBatch(recordBatch, key_indices, factor, &pool, &recordBatch));
+    }
+    ARROW_RETURN_NOT_OK(buffer->append(recordBatch));
+    total_bytes += recordBatchBytes(recordBatch);
+  }
+  ARROW_RETURN_NOT_OK(keyPartitions.finish());
+  if (buffer->size() == 0) {
+    return arrow::Status::Invalid("no rows in " + filename);
+  }
+
+  int64_t num_dup = 0;
+  if (!dedupe_on.empty()) {
+    std::vector<uint8_t> duplicate(num_row, 0);
+    std::atomic<size_t> next_partition(0);
+    int num_thread = std::min<int>(factor, num_partition);
+    pthread_t thread_arr[num_thread];
+    dedupe_partition_thread_args td[num_thread];
+    int rc;
+    for (int t=0; t<num_thread; t++) {
+      td[t].keys = &keyBuffer;
+      td[t].partitions = &partitions;
+      td[t].next_partition = &next_partition;
+      td[t].duplicate = &duplicate;
+      td[t].keep_last = keep_last;
+      td[t].num_dup = 0;
+      rc = pthread_create(&thread_arr[t], NULL, DedupePartitions, (void *)&td[t]);
+
+      if (rc) {
+        std::cout << "Error:unable to create thread," << rc << std::endl;
+        exit(EXIT_FAILURE);
+      }
+    }
+    for (int t=0; t<num_thread; t++) {
+      rc = pthread_join(thread_arr[t], NULL);
+      if (rc) {
+        std::cout << "Error:unable to join, " << rc << std::endl;
+        exit(EXIT_FAILURE);
+      }
+      ARROW_RETURN_NOT_OK(td[t].status);
+      num_dup += td[t].num_dup;
+    }
+
+    // drop the duplicates batch by batch, sorting what is left when asked to
+    std::unique_ptr<SpillBuffer> deduped(new SpillBuffer(&pool, limit_bytes / 4 * 3, spill_dir));
+    int64_t ordinal = 0;
+    total_bytes = 0;
+    for (size_t i=0; i<buffer->size(); i++) {
+      std::shared_ptr<arrow::RecordBatch> batch;
+      ARROW_RETURN_NOT_OK(buffer->take(i, &batch));
+      std::vector<int64_t> indices;
+      for (int64_t row=0; row<batch->num_rows(); row++) {
+        if (!duplicate[ordinal + row]) {
+          indices.push_back(row);
+        }
+      }
+      ordinal += batch->num_rows();
+      if (indices.empty()) {
+        continue;
+      }
+      if (indices.size() < (size_t) batch->num_rows()) {
+        arrow::ArrayVector columns, kept;
+        for (int c=0; c<batch->num_columns(); c++) {
+          columns.push_back(batch->column(c));
+        }
+        ARROW_RETURN_NOT_OK(takeRows(columns, indices, &pool, &kept));
+        batch = arrow::RecordBatch::Make(batch->schema(), indices.size(), kept);
+      }
+      if (!sort_by.empty()) {
+        if (key_indices.empty()) {
+          ARROW_RETURN_NOT_OK(resolveKeyColumns(batch->schema(), sort_by, &key_indices));
+        }
+        ARROW_RETURN_NOT_OK(sortRecordBatch(batch, key_indices, factor, &pool, &batch));
+      }
+      ARROW_RETURN_NOT_OK(deduped->append(batch));
+      total_bytes += recordBatchBytes(batch);
+    }
+    buffer.swap(deduped);
+  }
+
+  int num_run = 0, num_pass = 0;
+  if (!sort_by.empty() && buffer->size() > 1) {
+    num_run = buffer->size();
+    ARROW_RETURN_NOT_OK(mergeAllRuns(buffer, key_indices, limit_bytes / 4 * 3, spill_dir, &num_pass));
+  }
+
+  // split the batches into contiguous parts
+  size_t num_part = factor;
+  if (max_part_bytes > 0) {
+    num_part = std::max<size_t>(num_part, (total_bytes + max_part_bytes - 1) / max_part_bytes);
+  }
+  num_part = single_part ? 1 : std::min(num_part, buffer->size());
+  std::vector<budget_part> parts;
+  for (size_t p=0; p<num_part; p++) {
+    parts.push_back({output + std::to_string(p), p * buffer->size() / num_part, (p+1) * buffer->size() / num_part});
+  }
+
+  int num_thread = std::min<int>(factor, num_part);
+  std::atomic<size_t> next_part(0);
+  pthread_t thread_arr[num_thread];
+  write_part_thread_args td[num_thread];
+  int rc;
+  for (int t=0; t<num_thread; t++) {
+    td[t].parts = &parts;
+    td[t].next_part = &next_part;
+    td[t].buffer = buffer.get();
+    td[t].write_fn = &write_fn;
+    rc = pthread_create(&thread_arr[t], NULL, WriteParts, (void *)&td[t]);
+
+    if (rc) {
+      std::cout << "Error:unable to create thread," << rc << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  arrow::Status status;
+  for (int t=0; t<num_thread; t++) {
+    rc = pthread_join(thread_arr[t], NULL);
+    if (rc) {
+      std::cout << "Error:unable to join, " << rc << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    if (!td[t].status.ok()) {
+      status = td[t].status;
+    }
+  }
+
+  std::cout << "Budget: " << buffer->size() << " batches, " << buffer->spilled() << " spilled, peak "
+            << pool.max_memory() << " of " << limit_bytes << " bytes" << std::endl;
+  if (!dedupe_on.empty()) {
+    std::cout << "Dedupe: dropped " << num_dup << " of " << num_row << " rows on " << dedupe_on
+              << " in " << num_partition << " partitions" << std::endl;
+  }
+  if (num_run > 0) {
+    std::cout << "Sort: merged " << num_run << " sorted runs by " << sort_by << " in " << num_pass << " passes" << std::endl;
+  }
+  return status;
+}
+
+/*
+ * Function to read --memory-limit in MB and the spill directory
+ */
+int64_t parseMemoryLimit(const std::map<std::string, std::string> &options) {
+  auto it = options.find("memory-limit");
+  return it == options.end() ? 0 : boost::lexical_cast<int64_t>(it->second) << 20;
+}
+
+std::string parseSpillDir(const std::map<std::string, std::string> &options) {
+  auto it = options.find("spill-dir");
+  if (it != options.end() && !it->second.empty()) {
+    return it->second;
+  }
+  const char *tmpdir = getenv("TMPDIR");
+  return tmpdir ? tmpdir : "/tmp";
+}
@@ -0,0 +1,300 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <pthread.h>
+
+#include <arrow/api.h>
+#include <arrow/io/api.h>
+#include <parquet/arrow/writer.h>
+#include <parquet/arrow/schema.h>
+#include <parquet/exception.h>
+#include <parquet/file_reader.h>
+#include <parquet/file_writer.h>
+#include <parquet/metadata.h>
+
+// rows per row group of a single file written in parallel
+static const int64_t PARALLEL_ROW_GROUP_ROWS = 1 << 20;
+
+/*
+ * Class to write a parquet file out of already encoded column chunks
+ *
+ * Chunks are appended column by column, row group by row group. The pages of
+ * each are copied as they are from their source and its metadata, moved to
+ * the new offsets, is added to the footer written by close().
+ */
+class ParquetChunkSerializer {
+  private:
+    arrow::io::OutputStream *out;
+    int num_column;
+    int next_column;
+    int64_t position;
+    int64_t row_group_bytes;
+    int64_t num_row_group;
+    std::unique_ptr<parquet::FileMetaDataBuilder> metadata;
+    parquet::RowGroupMetaDataBuilder *row_group;
+
+  public:
+    ParquetChunkSerializer(arrow::io::OutputStream *out) :
+      out(out), num_column(0), next_column(0), position(0), row_group_bytes(0), num_row_group(0), row_group(nullptr)
+    { }
+
+    // function to write the leading magic and set up the footer, schema must outlive the serializer
+    arrow::Status open(const parquet::SchemaDescriptor *schema, std::shared_ptr<parquet::WriterProperties> properties,
+                       std::shared_ptr<const arrow::KeyValueMetadata> key_value_metadata) {
+      num_column = schema->num_columns();
+      PARQUET_CATCH_NOT_OK(metadata = parquet::FileMetaDataBuilder::Make(schema, properties, key_value_metadata));
+      ARROW_RETURN_NOT_OK(out->Write("PAR1", 4));
+      position = 4;
+      return arrow::Status::OK();
+    }
+
+    // function to copy the next column chunk from source, num_rows is that of its row group
+    arrow::Status append(const parquet::ColumnChunkMetaData &column, int64_t num_rows, arrow::io::RandomAccessFile *source) {
+      // the pages of a chunk are contiguous, dictionary page first
+      int64_t start = column.has_dictionary_page() ? column.dictionary_page_offset() : column.data_page_offset();
+      int64_t size = column.total_compressed_size();
+      std::shared_ptr<arrow::Buffer> pages;
+      ARROW_RETURN_NOT_OK(source->ReadAt(start, size, &pages));
+      ARROW_RETURN_NOT_OK(out->Write(pages->data(), pages->size()));
+
+      if (next_column == 0) {
+        PARQUET_CATCH_NOT_OK(row_group = metadata->AppendRowGroup());
+        row_group_bytes = 0;
+      }
+      parquet::ColumnChunkMetaDataBuilder *column_builder;
+      PARQUET_CATCH_NOT_OK(column_builder = row_group->NextColumnChunk());
+      if (column.is_stats_set()) {
+        PARQUET_CATCH_NOT_OK(column_builder->SetStatistics(column.statistics()->Encode()));
+      }
+      PARQUET_CATCH_NOT_OK(column_builder->Finish(column.num_values(),
+                           column.has_dictionary_page() ? position + column.dictionary_page_offset() - start : 0,
+                           -1, position + column.data_page_offset() - start,
+                           size, column.total_uncompressed_size(), column.has_dictionary_page(), false));
+      position += size;
+      row_group_bytes += column.total_uncompressed_size();
+
+      if (++next_column == num_column) {
+        PARQUET_CATCH_NOT_OK(row_group->set_num_rows(num_rows));
+        PARQUET_CATCH_NOT_OK(row_group->Finish(row_group_bytes));
+        next_column = 0;
+        num_row_group++;
+      }
+      return arrow::Status::OK();
+    }
+
+    // function to write the footer once every row group is complete
+    arrow::Status close() {
+      if (next_column != 0) {
+        return arrow::Status::Invalid("row group " + std::to_string(num_row_group) + " is missing columns");
+      }
+      std::unique_ptr<parquet::FileMetaData> file_metadata;
+      PARQUET_CATCH_NOT_OK(file_metadata = metadata->Finish());
+      PARQUET_CATCH_NOT_OK(parquet::WriteFileMetaData(*file_metadata, out));
+      return arrow::Status::OK();
+    }
+
+    int64_t getNumRowGroup() const {
+      return num_row_group;
+    }
+};
+
+/*
+ * Function to encode rows [offset, offset+length) of column c of a table on
+ * their own, as a one column, one row group parquet file in memory
+ */
+arrow::Status encodeColumnChunk(const std::shared_ptr<arrow::Table> &table, int c, int64_t offset, int64_t length,
+                                std::shared_ptr<parquet::WriterProperties> properties, std::shared_ptr<arrow::Buffer> *encoded) {
+  std::shared_ptr<arrow::Table> slice = table->Slice(offset, length);
+  std::shared_ptr<arrow::Table> column = arrow::Table::Make(arrow::schema({table->schema()->field(c)}),
+                                                            {slice->column(c)}, length);
+
+  std::shared_ptr<arrow::io::BufferOutputStream> stream;
+  ARROW_RETURN_NOT_OK(arrow::io::BufferOutputStream::Create(1 << 20, arrow::default_memory_pool(), &stream));
+  ARROW_RETURN_NOT_OK(parquet::arrow::WriteTable(*column, arrow::default_memory_pool(), stream, length, properties));
+  return stream->Finish(encoded);
+}
+
+/*
+ * Function to append the chunk encoded by encodeColumnChunk to a serializer
+ */
+arrow::Status appendEncodedChunk(ParquetChunkSerializer *serializer, const std::shared_ptr<arrow::Buffer> &encoded) {
+  std::shared_ptr<arrow::io::BufferReader> source = std::make_shared<arrow::io::BufferReader>(encoded);
+  std::shared_ptr<parquet::FileMetaData> chunk_metadata;
+  PARQUET_CATCH_NOT_OK(chunk_metadata = parquet::ReadMetaData(source));
+  return serializer->append(*chunk_metadata->RowGroup(0)->ColumnChunk(0), chunk_metadata->num_rows(), source.get());
+}
+
+/*
+ * Class to serialize the column chunks of a table in order while they are
+ * encoded in parallel
+ *
+ * Chunk j is column j % num_column of row group j / num_column, encoded by
+ * encodeColumnChunk. commit() hands it back and, once its turn comes, it is
+ * appended to the serializer, already open, so that several tables can follow
+ * each other in one file. At most window chunks are taken ahead of the last
+ * appended.
+ */
+class ParallelParquetWriter {
+  private:
+    std::shared_ptr<arrow::Table> table;
+    std::shared_ptr<parquet::WriterProperties> properties;
+    int64_t row_group_rows;
+    int num_column;
+    int64_t num_chunk;
+    int64_t window;
+    int64_t next_take;
+    int64_t next_write;
+    ParquetChunkSerializer *serializer;
+    std::map<int64_t, std::shared_ptr<arrow::Buffer>> finished;
+    arrow::Status status;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+
+  public:
+    ParallelParquetWriter(ParquetChunkSerializer *serializer, const std::shared_ptr<arrow::Table> &table,
+                          std::shared_ptr<parquet::WriterProperties> properties, int64_t row_group_rows, int64_t window) :
+      table(table), properties(properties), row_group_rows(std::max<int64_t>(row_group_rows, 1)),
+      num_column(table->num_columns()), window(window), next_take(0), next_write(0), serializer(serializer)
+    {
+      int64_t num_row_group = (table->num_rows() + this->row_group_rows - 1) / this->row_group_rows;
+      num_chunk = num_row_group * num_column;
+      pthread_mutex_init(&mutex, NULL);
+      pthread_cond_init(&cond, NULL);
+    }
+
+    ~ParallelParquetWriter() {
+      pthread_mutex_destroy(&mutex);
+      pthread_cond_destroy(&cond);
+    }
+
+    // function to take the next chunk, -1 when all chunks are taken
+    int64_t nextChunk() {
+      pthread_mutex_lock(&mutex);
+      while (next_take < num_chunk && next_take >= next_write + window) {
+        pthread_cond_wait(&cond, &mutex);
+      }
+      int64_t chunk = next_take < num_chunk ? next_take++ : -1;
+      pthread_mutex_unlock(&mutex);
+      return chunk;
+    }
+
+    arrow::Status encode(int64_t chunk, std::shared_ptr<arrow::Buffer> *encoded) {
+      int64_t offset = chunk / num_column * row_group_rows;
+      return encodeColumnChunk(table, chunk % num_column, offset,
+                               std::min(row_group_rows, table->num_rows() - offset), properties, encoded);
+    }
+
+    // function to hand back an encoded chunk, appended once its turn comes
+    void commit(int64_t chunk, const std::shared_ptr<arrow::Buffer> &encoded) {
+      pthread_mutex_lock(&mutex);
+      finished[chunk] = encoded;
+      while (!finished.empty() && finished.begin()->first == next_write) {
+        if (status.ok()) {
+          status = finished.begin()->second ? appendEncodedChunk(serializer, finished.begin()->second)
+                                            : arrow::Status::IOError("chunk " + std::to_string(next_write) + " failed to encode");
+        }
+        finished.erase(finished.begin());
+        next_write++;
+      }
+      pthread_cond_broadcast(&cond);
+      pthread_mutex_unlock(&mutex);
+    }
+
+    // function to get the first append error, once every chunk is committed
+    arrow::Status getStatus() const {
+      return status;
+    }
+
+    int64_t getNumChunk() const {
+      return num_chunk;
+    }
+};
+
+struct encode_chunk_thread_args {
+  ParallelParquetWriter *writer;
+  arrow::Status status;
+};
+
+/*
+ * Function to encode chunks until none is left
+ */
+void *EncodeChunks(void *threadarg) {
+  struct encode_chunk_thread_args *args;
+  args = (struct encode_chunk_thread_args *) threadarg;
+
+  int64_t chunk;
+  while ((chunk = args->writer->nextChunk()) >= 0) {
+    std::shared_ptr<arrow::Buffer> encoded;
+    if (args->status.ok()) {
+      args->status = args->writer->encode(chunk, &encoded);
+    }
+    // always commit so that the following chunks are not held back
+    args->writer->commit(chunk, args->status.ok() ? encoded : nullptr);
+  }
+
+  pthread_exit(NULL);
+}
+
+/*
+ * Function to append the row groups of a table to an open serializer, their
+ * column chunks encoded and compressed by factor threads
+ */
+arrow::Status encodeTableParallel(const std::shared_ptr<arrow::Table> &table, ParquetChunkSerializer *serializer,
+                                  std::shared_ptr<parquet::WriterProperties> properties,
+                                  int64_t row_group_rows, int factor) {
+  if (factor < 1) {
+    factor = 1;
+  }
+  ParallelParquetWriter writer(serializer, table, properties, row_group_rows, 2 * factor);
+
+  pthread_t thread_arr[factor];
+  encode_chunk_thread_args td[factor];
+  int rc;
+  for (int t=0; t<factor; t++) {
+    td[t].writer = &writer;
+    rc = pthread_create(&thread_arr[t], NULL, EncodeChunks, (void *)&td[t]);
+
+    if (rc) {
+      std::cout << "Error:unable to create thread," << rc << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  arrow::Status status;
+  for (int t=0; t<factor; t++) {
+    rc = pthread_join(thread_arr[t], NULL);
+    if (rc) {
+      std::cout << "Error:unable to join, " << rc << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    if (!td[t].status.ok()) {
+      status = td[t].status;
+    }
+  }
+  ARROW_RETURN_NOT_OK(status);
+  return writer.getStatus();
+}
+
+/*
+ * Function to write a table as one parquet file, its column chunks encoded
+ * and compressed by factor threads and appended in order
+ */
+arrow::Status writeParquetParallel(const std::shared_ptr<arrow::Table> &table, arrow::io::OutputStream *out,
+                                   std::shared_ptr<parquet::WriterProperties> properties,
+                                   int64_t row_group_rows, int factor) {
+  std::shared_ptr<parquet::SchemaDescriptor> parquet_schema;
+  ARROW_RETURN_NOT_OK(parquet::arrow::ToParquetSchema(table->schema().get(), *properties, &parquet_schema));
+  ParquetChunkSerializer serializer(out);
+  ARROW_RETURN_NOT_OK(serializer.open(parquet_schema.get(), properties, table->schema()->metadata()));
+  ARROW_RETURN_NOT_OK(encodeTableParallel(table, &serializer, properties, row_group_rows, factor));
+  ARROW_RETURN_NOT_OK(serializer.close());
+
+  std::cout << "Write: " << serializer.getNumRowGroup() << " row groups with " << std::max(factor, 1) << " threads" << std::endl;
+  return arrow::Status::OK();
+}
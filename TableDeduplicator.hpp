@@ -0,0 +1,276 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <pthread.h>
+
+#include "ColumnStats.hpp"
+#include "TableSorter.hpp"
+#include <arrow/api.h>
+
+// bytes held per row while deduplicating, besides its keys: ordinal, hash,
+// row index, duplicate flag and two slots of the flat hash table
+static const int64_t DEDUPE_ROW_BYTES = 64;
+
+/*
+ * Function to hash the key values of a row, equal keys hash equal
+ */
+uint64_t hashKeyRow(const std::vector<const arrow::Array*> &keys, int64_t row) {
+  uint64_t h = 0x9e3779b97f4a7c15ULL;
+  for (const arrow::Array *key : keys) {
+    uint64_t v = 0;
+    if (key->IsNull(row)) {
+      v = 0x5bd1e9955bd1e995ULL;
+    } else {
+      switch (key->type_id()) {
+        case arrow::Type::INT32:
+          v = hashMix((uint64_t) static_cast<const arrow::Int32Array*>(key)->Value(row));
+          break;
+        case arrow::Type::INT64:
+          v = hashMix((uint64_t) static_cast<const arrow::Int64Array*>(key)->Value(row));
+          break;
+        case arrow::Type::FLOAT:
+        case arrow::Type::DOUBLE: {
+          double d = key->type_id() == arrow::Type::FLOAT ? static_cast<const arrow::FloatArray*>(key)->Value(row)
+                                                          : static_cast<const arrow::DoubleArray*>(key)->Value(row);
+          if (d == 0) {
+            d = 0;  // -0.0 compares equal to 0.0
+          }
+          memcpy(&v, &d, sizeof(v));
+          v = hashMix(v);
+          break;
+        }
+        case arrow::Type::STRING: {
+          int32_t length;
+          const uint8_t *value = static_cast<const arrow::StringArray*>(key)->GetValue(row, &length);
+          v = hashBytes((const char *) value, length);
+          break;
+        }
+        case arrow::Type::BOOL:
+          v = hashMix(static_cast<const arrow::BooleanArray*>(key)->Value(row) ? 1 : 2);
+          break;
+        default:
+          break;
+      }
+    }
+    h = hashMix(h ^ v);
+  }
+  return h;
+}
+
+// slot of the flat hash table of markDuplicateRows, empty while row < 0
+struct dedupe_slot {
+  uint64_t hash;
+  int64_t row;
+};
+
+/*
+ * Function to mark every row of rows whose keys equal those of a row before it,
+ * or after it when keep_last. Returns the number of rows marked.
+ *
+ * Kept rows go to a flat open addressing table of at least twice as many
+ * slots as rows, probed linearly; rows are compared only on equal hashes.
+ */
+int64_t markDuplicateRows(const std::vector<const arrow::Array*> &keys, const std::vector<uint64_t> &hashes,
+                          const std::vector<int64_t> &rows, bool keep_last, std::vector<uint8_t> *duplicate) {
+  int bits = 4;
+  while (((size_t) 1 << bits) < rows.size() * 2) {
+    bits++;
+  }
+  size_t mask = ((size_t) 1 << bits) - 1;
+  std::vector<dedupe_slot> slots(mask + 1, {0, -1});
+
+  int64_t num_dup = 0;
+  for (size_t n=0; n<rows.size(); n++) {
+    int64_t row = rows[keep_last ? rows.size() - 1 - n : n];
+    uint64_t h = hashes[row];
+    // the high bits, the low ones are shared by the rows of a hash partition
+    size_t s = (h * 0x9e3779b97f4a7c15ULL) >> (64 - bits);
+    bool found = false;
+    while (slots[s].row >= 0) {
+      if (slots[s].hash == h && compareRows(keys, row, keys, slots[s].row) == 0) {
+        found = true;
+        break;
+      }
+      s = (s + 1) & mask;
+    }
+    if (found) {
+      (*duplicate)[row] = 1;
+      num_dup++;
+    } else {
+      slots[s] = {h, row};
+    }
+  }
+  return num_dup;
+}
+
+struct dedupe_thread_args {
+  const std::vector<const arrow::Array*> *keys;
+  std::vector<uint64_t> *hashes;
+  std::vector<std::vector<std::vector<int64_t>>> *partitions;  // rows of [range][partition]
+  std::vector<uint8_t> *duplicate;
+  int index;  // range to hash or partition to dedupe
+  int64_t begin;
+  int64_t end;
+  bool keep_last;
+  int64_t num_dup;
+};
+
+void *HashRange(void *threadarg) {
+  struct dedupe_thread_args *args = (struct dedupe_thread_args *) threadarg;
+  std::vector<std::vector<int64_t>> &partition_rows = args->partitions->at(args->index);
+  for (int64_t row=args->begin; row<args->end; row++) {
+    uint64_t h = hashKeyRow(*args->keys, row);
+    (*args->hashes)[row] = h;
+    partition_rows[h % partition_rows.size()].push_back(row);
+  }
+  pthread_exit(NULL);
+}
+
+void *DedupePartition(void *threadarg) {
+  struct dedupe_thread_args *args = (struct dedupe_thread_args *) threadarg;
+  // ranges are in row order, so are the rows of the partition
+  std::vector<int64_t> rows;
+  for (std::vector<std::vector<int64_t>> &partition_rows : *args->partitions) {
+    rows.insert(rows.end(), partition_rows[args->index].begin(), partition_rows[args->index].end());
+  }
+  args->num_dup = markDuplicateRows(*args->keys, *args->hashes, rows, args->keep_last, args->duplicate);
+  pthread_exit(NULL);
+}
+
+/*
+ * Function to drop the rows of a table whose "<col>,<col>" keys repeat, keeping
+ * the first (or last when keep_last) of them
+ *
+ * Rows are hashed in num_thread ranges in parallel and hash-partitioned, then
+ * every partition is deduplicated by its own thread.
+ */
+arrow::Status dedupeTable(const std::shared_ptr<arrow::Table> &table, std::string dedupe_on, bool keep_last,
+                          int num_thread, std::shared_ptr<arrow::Table> *out) {
+  arrow::MemoryPool *pool = arrow::default_memory_pool();
+  std::vector<int> key_indices;
+  ARROW_RETURN_NOT_OK(resolveKeyColumns(table->schema(), dedupe_on, &key_indices));
+
+  std::shared_ptr<arrow::RecordBatch> batch;
+  ARROW_RETURN_NOT_OK(tableToRecordBatch(table, pool, &batch));
+  std::vector<const arrow::Array*> keys;
+  for (int idx : key_indices) {
+    keys.push_back(batch->column(idx).get());
+  }
+
+  int64_t num_row = batch->num_rows();
+  num_thread = std::max<int>(1, std::min<int64_t>(num_thread, num_row / 1024 + 1));
+  std::vector<uint64_t> hashes(num_row);
+  std::vector<std::vector<std::vector<int64_t>>> partitions(num_thread, std::vector<std::vector<int64_t>>(num_thread));
+  std::vector<uint8_t> duplicate(num_row, 0);
+
+  std::vector<pthread_t> thread_arr(num_thread);
+  std::vector<dedupe_thread_args> td(num_thread);
+  for (int t=0; t<num_thread; t++) {
+    td[t] = {&keys, &hashes, &partitions, &duplicate, t, num_row * t / num_thread, num_row * (t+1) / num_thread, keep_last, 0};
+    if (pthread_create(&thread_arr[t], NULL, HashRange, (void *)&td[t])) {
+      std::cout << "Error:unable to create thread" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (int t=0; t<num_thread; t++) {
+    pthread_join(thread_arr[t], NULL);
+  }
+
+  for (int t=0; t<num_thread; t++) {
+    if (pthread_create(&thread_arr[t], NULL, DedupePartition, (void *)&td[t])) {
+      std::cout << "Error:unable to create thread" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+  int64_t num_dup = 0;
+  for (int t=0; t<num_thread; t++) {
+    pthread_join(thread_arr[t], NULL);
+    num_dup += td[t].num_dup;
+  }
+
+  std::cout << "Dedupe: dropped " << num_dup << " of " << num_row << " rows on " << dedupe_on << std::endl;
+  if (num_dup == 0) {
+    *out = table;
+    return arrow::Status::OK();
+  }
+
+  std::vector<int64_t> indices;
+  for (int64_t row=0; row<num_row; row++) {
+    if (!duplicate[row]) {
+      indices.push_back(row);
+    }
+  }
+  arrow::ArrayVector columns, kept;
+  for (int i=0; i<batch->num_columns(); i++) {
+    columns.push_back(batch->column(i));
+  }
+  ARROW_RETURN_NOT_OK(takeRows(columns, indices, pool, &kept));
+  return arrow::Table::FromRecordBatches({arrow::RecordBatch::Make(batch->schema(), indices.size(), kept)}, out);
+}
+
+/*
+ * Function to split the key columns of a batch by hash into num_partition batches
+ *
+ * Every partition batch holds the key columns of its rows plus an "ordinal"
+ * column, the row number in the whole input starting at first_ordinal.
+ * Partitions without rows are left null.
+ */
+arrow::Status partitionKeys(const std::shared_ptr<arrow::RecordBatch> &batch, const std::vector<int> &key_indices,
+                            int64_t first_ordinal, size_t num_partition, arrow::MemoryPool *pool,
+                            std::vector<std::shared_ptr<arrow::RecordBatch>> *out) {
+  std::vector<const arrow::Array*> keys;
+  arrow::ArrayVector key_columns;
+  std::vector<std::shared_ptr<arrow::Field>> fields;
+  for (int idx : key_indices) {
+    keys.push_back(batch->column(idx).get());
+    key_columns.push_back(batch->column(idx));
+    fields.push_back(batch->schema()->field(idx));
+  }
+  fields.push_back(arrow::field("ordinal", arrow::int64()));
+  std::shared_ptr<arrow::Schema> schema = arrow::schema(fields);
+
+  std::vector<std::vector<int64_t>> partition_rows(num_partition);
+  for (int64_t row=0; row<batch->num_rows(); row++) {
+    partition_rows[hashKeyRow(keys, row) % num_partition].push_back(row);
+  }
+
+  out->assign(num_partition, nullptr);
+  for (size_t p=0; p<num_partition; p++) {
+    std::vector<int64_t> &rows = partition_rows[p];
+    if (rows.empty()) {
+      continue;
+    }
+    arrow::ArrayVector columns;
+    ARROW_RETURN_NOT_OK(takeRows(key_columns, rows, pool, &columns));
+
+    arrow::Int64Builder ordinalBuilder(pool);
+    ARROW_RETURN_NOT_OK(ordinalBuilder.Reserve(rows.size()));
+    for (int64_t row : rows) {
+      ordinalBuilder.UnsafeAppend(first_ordinal + row);
+    }
+    std::shared_ptr<arrow::Array> ordinals;
+    ARROW_RETURN_NOT_OK(ordinalBuilder.Finish(&ordinals));
+    columns.push_back(ordinals);
+
+    (*out)[p] = arrow::RecordBatch::Make(schema, rows.size(), columns);
+  }
+  return arrow::Status::OK();
+}
+
+/*
+ * Function to read --keep, first unless "last"
+ */
+arrow::Status parseKeepLast(const std::map<std::string, std::string> &options, bool *keep_last) {
+  auto it = options.find("keep");
+  std::string keep = it == options.end() ? "first" : it->second;
+  if (keep != "first" && keep != "last") {
+    return arrow::Status::Invalid("--keep must be first or last, not " + keep);
+  }
+  *keep_last = keep == "last";
+  return arrow::Status::OK();
+}
@@ -0,0 +1,270 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <pthread.h>
+
+#include <arrow/api.h>
+#include <arrow/array/concatenate.h>
+#include <arrow/compute/api.h>
+#include <boost/algorithm/string.hpp>
+
+/*
+ * Function to compare two floating point numbers, NaN after every number
+ * and equal to itself so that the order stays strict weak
+ */
+template <typename T>
+int compareFloats(T x, T y) {
+  bool x_nan = std::isnan(x), y_nan = std::isnan(y);
+  if (x_nan || y_nan) {
+    return x_nan == y_nan ? 0 : (x_nan ? 1 : -1);
+  }
+  return (x > y) - (x < y);
+}
+
+/*
+ * Function to compare value i of a with value j of b, both of the same type.
+ * NaN sorts after every number, nulls after every value.
+ */
+int compareValues(const arrow::Array *a, int64_t i, const arrow::Array *b, int64_t j) {
+  bool a_null = a->IsNull(i), b_null = b->IsNull(j);
+  if (a_null || b_null) {
+    return a_null == b_null ? 0 : (a_null ? 1 : -1);
+  }
+
+  switch (a->type_id()) {
+    case arrow::Type::INT32: {
+      int32_t x = static_cast<const arrow::Int32Array*>(a)->Value(i);
+      int32_t y = static_cast<const arrow::Int32Array*>(b)->Value(j);
+      return (x > y) - (x < y);
+    }
+    case arrow::Type::INT64: {
+      int64_t x = static_cast<const arrow::Int64Array*>(a)->Value(i);
+      int64_t y = static_cast<const arrow::Int64Array*>(b)->Value(j);
+      return (x > y) - (x < y);
+    }
+    case arrow::Type::FLOAT: {
+      float x = static_cast<const arrow::FloatArray*>(a)->Value(i);
+      float y = static_cast<const arrow::FloatArray*>(b)->Value(j);
+      return compareFloats(x, y);
+    }
+    case arrow::Type::DOUBLE: {
+      double x = static_cast<const arrow::DoubleArray*>(a)->Value(i);
+      double y = static_cast<const arrow::DoubleArray*>(b)->Value(j);
+      return compareFloats(x, y);
+    }
+    case arrow::Type::STRING: {
+      int32_t x_len, y_len;
+      const uint8_t *x = static_cast<const arrow::StringArray*>(a)->GetValue(i, &x_len);
+      const uint8_t *y = static_cast<const arrow::StringArray*>(b)->GetValue(j, &y_len);
+      int c = memcmp(x, y, std::min(x_len, y_len));
+      return c != 0 ? c : (x_len > y_len) - (x_len < y_len);
+    }
+    case arrow::Type::BOOL: {
+      bool x = static_cast<const arrow::BooleanArray*>(a)->Value(i);
+      bool y = static_cast<const arrow::BooleanArray*>(b)->Value(j);
+      return (x > y) - (x < y);
+    }
+    default:
+      return 0;
+  }
+}
+
+/*
+ * Function to compare row i of key columns a with row j of key columns b
+ */
+int compareRows(const std::vector<const arrow::Array*> &a, int64_t i,
+                const std::vector<const arrow::Array*> &b, int64_t j) {
+  for (size_t k=0; k<a.size(); k++) {
+    int c = compareValues(a[k], i, b[k], j);
+    if (c != 0) {
+      return c;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Function to resolve "<col>,<col>" to column indices of schema
+ */
+arrow::Status resolveKeyColumns(const std::shared_ptr<arrow::Schema> &schema, std::string columns,
+                                std::vector<int> *indices) {
+  std::vector<std::string> names;
+  boost::algorithm::split(names, columns, boost::is_any_of(","));
+  for (std::string name : names) {
+    boost::trim(name);
+    int idx = schema->GetFieldIndex(name);
+    if (idx < 0) {
+      return arrow::Status::KeyError("no column " + name);
+    }
+    indices->push_back(idx);
+  }
+  return arrow::Status::OK();
+}
+
+struct sort_range_thread_args {
+  std::vector<int64_t> *indices;
+  const std::vector<const arrow::Array*> *keys;
+  int64_t begin;
+  int64_t middle;  // merge only: end of the first sorted half
+  int64_t end;
+};
+
+// ties keep input order so the sort is stable
+struct row_index_less {
+  const std::vector<const arrow::Array*> *keys;
+  bool operator()(int64_t x, int64_t y) const {
+    int c = compareRows(*keys, x, *keys, y);
+    return c != 0 ? c < 0 : x < y;
+  }
+};
+
+void *SortRange(void *threadarg) {
+  struct sort_range_thread_args *args = (struct sort_range_thread_args *) threadarg;
+  std::sort(args->indices->begin() + args->begin, args->indices->begin() + args->end, row_index_less{args->keys});
+  pthread_exit(NULL);
+}
+
+void *MergeRanges(void *threadarg) {
+  struct sort_range_thread_args *args = (struct sort_range_thread_args *) threadarg;
+  std::inplace_merge(args->indices->begin() + args->begin, args->indices->begin() + args->middle,
+                     args->indices->begin() + args->end, row_index_less{args->keys});
+  pthread_exit(NULL);
+}
+
+/*
+ * Function to sort the row indices 0..num_row-1 by the key columns
+ *
+ * The rows are split in num_thread ranges sorted in parallel, then the
+ * sorted ranges are merged pairwise, each round merging its pairs in parallel.
+ */
+std::vector<int64_t> sortRowIndices(const std::vector<const arrow::Array*> &keys, int64_t num_row, int num_thread) {
+  std::vector<int64_t> indices(num_row);
+  for (int64_t i=0; i<num_row; i++) {
+    indices[i] = i;
+  }
+  num_thread = std::max<int>(1, std::min<int64_t>(num_thread, num_row / 1024 + 1));
+
+  std::vector<int64_t> bounds;
+  for (int t=0; t<=num_thread; t++) {
+    bounds.push_back(num_row * t / num_thread);
+  }
+
+  std::vector<pthread_t> thread_arr(num_thread);
+  std::vector<sort_range_thread_args> td(num_thread);
+  for (int t=0; t<num_thread; t++) {
+    td[t] = {&indices, &keys, bounds[t], bounds[t], bounds[t+1]};
+    if (pthread_create(&thread_arr[t], NULL, SortRange, (void *)&td[t])) {
+      std::cout << "Error:unable to create thread" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (int t=0; t<num_thread; t++) {
+    pthread_join(thread_arr[t], NULL);
+  }
+
+  while (bounds.size() > 2) {
+    std::vector<int64_t> next_bounds;
+    int num_merge = (bounds.size() - 1) / 2;
+    for (int p=0; p<num_merge; p++) {
+      td[p] = {&indices, &keys, bounds[2*p], bounds[2*p+1], bounds[2*p+2]};
+      if (pthread_create(&thread_arr[p], NULL, MergeRanges, (void *)&td[p])) {
+        std::cout << "Error:unable to create thread" << std::endl;
+        exit(EXIT_FAILURE);
+      }
+      next_bounds.push_back(bounds[2*p]);
+    }
+    for (int p=0; p<num_merge; p++) {
+      pthread_join(thread_arr[p], NULL);
+    }
+    if ((bounds.size() - 1) % 2 == 1) {  // odd range out waits for the next round
+      next_bounds.push_back(bounds[bounds.size() - 2]);
+    }
+    next_bounds.push_back(bounds.back());
+    bounds.swap(next_bounds);
+  }
+
+  return indices;
+}
+
+/*
+ * Function to reorder columns by the row indices
+ */
+arrow::Status takeRows(const arrow::ArrayVector &columns, const std::vector<int64_t> &indices,
+                       arrow::MemoryPool *pool, arrow::ArrayVector *out) {
+  arrow::Int64Builder indexBuilder(pool);
+  ARROW_RETURN_NOT_OK(indexBuilder.AppendValues(indices));
+  std::shared_ptr<arrow::Array> indexArray;
+  ARROW_RETURN_NOT_OK(indexBuilder.Finish(&indexArray));
+
+  arrow::compute::FunctionContext ctx(pool);
+  arrow::compute::TakeOptions options;
+  out->clear();
+  for (const std::shared_ptr<arrow::Array> &column : columns) {
+    std::shared_ptr<arrow::Array> taken;
+    ARROW_RETURN_NOT_OK(arrow::compute::Take(&ctx, *column, *indexArray, options, &taken));
+    out->push_back(taken);
+  }
+  return arrow::Status::OK();
+}
+
+/*
+ * Function to sort a record batch by the key columns
+ */
+arrow::Status sortRecordBatch(const std::shared_ptr<arrow::RecordBatch> &batch, const std::vector<int> &key_indices,
+                              int num_thread, arrow::MemoryPool *pool, std::shared_ptr<arrow::RecordBatch> *out) {
+  std::vector<const arrow::Array*> keys;
+  for (int idx : key_indices) {
+    keys.push_back(batch->column(idx).get());
+  }
+  std::vector<int64_t> indices = sortRowIndices(keys, batch->num_rows(), num_thread);
+
+  arrow::ArrayVector columns, sorted;
+  for (int i=0; i<batch->num_columns(); i++) {
+    columns.push_back(batch->column(i));
+  }
+  ARROW_RETURN_NOT_OK(takeRows(columns, indices, pool, &sorted));
+  *out = arrow::RecordBatch::Make(batch->schema(), batch->num_rows(), sorted);
+  return arrow::Status::OK();
+}
+
+/*
+ * Function to make a record batch of a table, every column as one contiguous array
+ */
+arrow::Status tableToRecordBatch(const std::shared_ptr<arrow::Table> &table, arrow::MemoryPool *pool,
+                                 std::shared_ptr<arrow::RecordBatch> *out) {
+  arrow::ArrayVector columns;
+  for (int i=0; i<table->num_columns(); i++) {
+    std::shared_ptr<arrow::ChunkedArray> chunks = table->column(i)->data();
+    std::shared_ptr<arrow::Array> column;
+    if (chunks->num_chunks() == 1) {
+      column = chunks->chunk(0);
+    } else {
+      ARROW_RETURN_NOT_OK(arrow::Concatenate(chunks->chunks(), pool, &column));
+    }
+    columns.push_back(column);
+  }
+  *out = arrow::RecordBatch::Make(table->schema(), table->num_rows(), columns);
+  return arrow::Status::OK();
+}
+
+/*
+ * Function to sort a table by "<col>,<col>" with num_thread threads
+ */
+arrow::Status sortTable(const std::shared_ptr<arrow::Table> &table, std::string sort_by, int num_thread,
+                        std::shared_ptr<arrow::Table> *out) {
+  arrow::MemoryPool *pool = arrow::default_memory_pool();
+  std::vector<int> key_indices;
+  ARROW_RETURN_NOT_OK(resolveKeyColumns(table->schema(), sort_by, &key_indices));
+
+  std::shared_ptr<arrow::RecordBatch> batch;
+  ARROW_RETURN_NOT_OK(tableToRecordBatch(table, pool, &batch));
+  std::shared_ptr<arrow::RecordBatch> sorted;
+  ARROW_RETURN_NOT_OK(sortRecordBatch(batch, key_indices, num_thread, pool, &sorted));
+  return arrow::Table::FromRecordBatches({sorted}, out);
+}
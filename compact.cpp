@@ -0,0 +1,365 @@
+#include <cstdint>
+#include <iostream>
+#include <vector>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <cstdlib>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "BatchScheduler.hpp"
+#include "ParallelParquetWriter.hpp"
+#include "AsyncOutputStream.hpp"
+#include "ConverterOptions.hpp"
+#include <arrow/api.h>
+#include <arrow/io/api.h>
+#include <arrow/ipc/api.h>
+#include <parquet/arrow/reader.h>
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+
+struct compact_output {
+  std::string name;
+  std::vector<std::string> inputs;
+};
+
+struct compact_thread_args {
+  std::vector<compact_output> *outputs;
+  std::atomic<size_t> *next_output;
+  bool parquet;
+  int64_t row_group_rows;
+  int64_t num_copied;     // parquet row groups copied without decoding
+  int64_t num_reencoded;  // parquet row groups written from merged small ones
+  arrow::Status status;
+};
+
+/*
+ * Function to group the inputs, in order, into outputs of about target_bytes
+ */
+std::vector<compact_output> groupBySize(const std::vector<std::string> &files, int64_t target_bytes,
+                                        std::string prefix, std::string extension) {
+  std::vector<compact_output> outputs;
+  int64_t bytes = 0;
+  for (const std::string &file : files) {
+    struct stat file_stat;
+    int64_t size = stat(file.c_str(), &file_stat) == 0 ? file_stat.st_size : 0;
+    if (outputs.empty() || (bytes + size > target_bytes && !outputs.back().inputs.empty())) {
+      outputs.push_back({prefix + std::to_string(outputs.size()) + extension, {}});
+      bytes = 0;
+    }
+    outputs.back().inputs.push_back(file);
+    bytes += size;
+  }
+  return outputs;
+}
+
+/*
+ * Function to make writer properties matching the compression and dictionary
+ * encoding of the first row group of a parquet file
+ */
+std::shared_ptr<parquet::WriterProperties> writerPropertiesLike(const parquet::FileMetaData &metadata) {
+  parquet::WriterProperties::Builder builder;
+  builder.enable_statistics();
+  if (metadata.num_row_groups() > 0) {
+    std::unique_ptr<parquet::RowGroupMetaData> row_group = metadata.RowGroup(0);
+    for (int c=0; c<metadata.num_columns(); c++) {
+      std::unique_ptr<parquet::ColumnChunkMetaData> column = row_group->ColumnChunk(c);
+      std::string path = metadata.schema()->Column(c)->path()->ToDotString();
+      builder.compression(path, column->compression());
+      if (column->has_dictionary_page()) {
+        builder.enable_dictionary(path);
+      } else {
+        builder.disable_dictionary(path);
+      }
+    }
+  }
+  return builder.build();
+}
+
+/*
+ * Function to tell whether the pages of a row group can be copied as they are:
+ * the footer takes the codec and encodings of every column chunk from properties,
+ * so every chunk must have been compressed and dictionary encoded as they say
+ */
+bool matchesProperties(const parquet::RowGroupMetaData &row_group, const parquet::SchemaDescriptor *schema,
+                       const parquet::WriterProperties &properties) {
+  for (int c=0; c<row_group.num_columns(); c++) {
+    std::unique_ptr<parquet::ColumnChunkMetaData> column = row_group.ColumnChunk(c);
+    std::shared_ptr<parquet::schema::ColumnPath> path = schema->Column(c)->path();
+    if (column->compression() != properties.compression(path) ||
+        column->has_dictionary_page() != properties.dictionary_enabled(path)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * Function to copy the key-value metadata of an input but its column_statistics,
+ * which describe only that input
+ */
+std::shared_ptr<const arrow::KeyValueMetadata> compactedMetadata(const std::shared_ptr<const arrow::KeyValueMetadata> &metadata) {
+  if (!metadata) {
+    return nullptr;
+  }
+  std::vector<std::string> keys, values;
+  for (int64_t i=0; i<metadata->size(); i++) {
+    if (metadata->key(i) != "column_statistics") {
+      keys.push_back(metadata->key(i));
+      values.push_back(metadata->value(i));
+    }
+  }
+  return std::make_shared<arrow::KeyValueMetadata>(keys, values);
+}
+
+/*
+ * Function to merge the decoded small row groups into one row group of the output
+ */
+arrow::Status flushPending(std::vector<std::shared_ptr<arrow::Table>> &pending, ParquetChunkSerializer *serializer,
+                           std::shared_ptr<parquet::WriterProperties> properties, int64_t *num_reencoded) {
+  if (pending.empty()) {
+    return arrow::Status::OK();
+  }
+  std::shared_ptr<arrow::Table> table;
+  ARROW_RETURN_NOT_OK(arrow::ConcatenateTables(pending, &table));
+  pending.clear();
+  for (int c=0; c<table->num_columns(); c++) {
+    std::shared_ptr<arrow::Buffer> encoded;
+    ARROW_RETURN_NOT_OK(encodeColumnChunk(table, c, 0, table->num_rows(), properties, &encoded));
+    ARROW_RETURN_NOT_OK(appendEncodedChunk(serializer, encoded));
+  }
+  (*num_reencoded)++;
+  return arrow::Status::OK();
+}
+
+/*
+ * Function to compact parquet inputs into one file
+ *
+ * Row groups of at least half of row_group_rows are copied as they are, page
+ * bytes and all, when compressed and encoded as the first row group of the
+ * first input. Smaller or differently encoded ones are decoded and merged
+ * until they reach row_group_rows, then encoded again as one row group. Only one column chunk,
+ * or one pending row group, is held in memory at a time.
+ */
+arrow::Status compactParquet(const compact_output &output, int64_t row_group_rows,
+                             int64_t *num_copied, int64_t *num_reencoded) {
+  std::shared_ptr<arrow::io::OutputStream> outfile;
+  ARROW_RETURN_NOT_OK(openOutputStream(output.name, &outfile));
+  ParquetChunkSerializer serializer(outfile.get());
+
+  std::shared_ptr<parquet::FileMetaData> first_metadata;
+  std::shared_ptr<parquet::WriterProperties> properties;
+  std::vector<std::shared_ptr<arrow::Table>> pending;
+  int64_t pending_rows = 0;
+  for (const std::string &filename : output.inputs) {
+    std::shared_ptr<arrow::io::MemoryMappedFile> infile;
+    ARROW_RETURN_NOT_OK(arrow::io::MemoryMappedFile::Open(filename, arrow::io::FileMode::READ, &infile));
+    std::unique_ptr<parquet::arrow::FileReader> reader;
+    ARROW_RETURN_NOT_OK(parquet::arrow::OpenFile(infile, arrow::default_memory_pool(), &reader));
+    std::shared_ptr<parquet::FileMetaData> metadata = reader->parquet_reader()->metadata();
+
+    if (!first_metadata) {
+      first_metadata = metadata;
+      properties = writerPropertiesLike(*metadata);
+      ARROW_RETURN_NOT_OK(serializer.open(first_metadata->schema(), properties,
+                                          compactedMetadata(first_metadata->key_value_metadata())));
+    } else if (!metadata->schema()->Equals(*first_metadata->schema())) {
+      return arrow::Status::Invalid(filename + " does not have the schema of " + output.inputs[0]);
+    }
+
+    for (int r=0; r<metadata->num_row_groups(); r++) {
+      std::unique_ptr<parquet::RowGroupMetaData> row_group = metadata->RowGroup(r);
+      if (row_group->num_rows() * 2 >= row_group_rows &&
+          matchesProperties(*row_group, first_metadata->schema(), *properties)) {
+        // keep the row order, the merged small row groups go first
+        ARROW_RETURN_NOT_OK(flushPending(pending, &serializer, properties, num_reencoded));
+        pending_rows = 0;
+        for (int c=0; c<row_group->num_columns(); c++) {
+          ARROW_RETURN_NOT_OK(serializer.append(*row_group->ColumnChunk(c), row_group->num_rows(), infile.get()));
+        }
+        (*num_copied)++;
+      } else {
+        std::shared_ptr<arrow::Table> table;
+        ARROW_RETURN_NOT_OK(reader->ReadRowGroup(r, &table));
+        pending.push_back(table);
+        pending_rows += table->num_rows();
+        if (pending_rows >= row_group_rows) {
+          ARROW_RETURN_NOT_OK(flushPending(pending, &serializer, properties, num_reencoded));
+          pending_rows = 0;
+        }
+      }
+    }
+  }
+  ARROW_RETURN_NOT_OK(flushPending(pending, &serializer, properties, num_reencoded));
+  ARROW_RETURN_NOT_OK(serializer.close());
+
+  return outfile->Close();
+}
+
+/*
+ * Function to compact feather inputs into one file
+ *
+ * Feather files hold every column contiguously, so the output is written
+ * column by column: the column of every (memory mapped) input is concatenated
+ * and appended, holding one output column in memory at a time.
+ */
+arrow::Status compactFeather(const compact_output &output) {
+  std::vector<std::unique_ptr<arrow::ipc::feather::TableReader>> readers;
+  int64_t num_rows = 0;
+  for (const std::string &filename : output.inputs) {
+    std::shared_ptr<arrow::io::MemoryMappedFile> infile;
+    ARROW_RETURN_NOT_OK(arrow::io::MemoryMappedFile::Open(filename, arrow::io::FileMode::READ, &infile));
+    std::unique_ptr<arrow::ipc::feather::TableReader> reader;
+    ARROW_RETURN_NOT_OK(arrow::ipc::feather::TableReader::Open(infile, &reader));
+    if (!readers.empty() && reader->num_columns() != readers[0]->num_columns()) {
+      return arrow::Status::Invalid(filename + " does not have the columns of " + output.inputs[0]);
+    }
+    num_rows += reader->num_rows();
+    readers.push_back(std::move(reader));
+  }
+
+  std::shared_ptr<arrow::io::OutputStream> outfile;
+  ARROW_RETURN_NOT_OK(openOutputStream(output.name, &outfile));
+  std::unique_ptr<arrow::ipc::feather::TableWriter> writer;
+  ARROW_RETURN_NOT_OK(arrow::ipc::feather::TableWriter::Open(outfile, &writer));
+  writer->SetNumRows(num_rows);
+
+  for (int c=0; c<readers[0]->num_columns(); c++) {
+    std::string name = readers[0]->GetColumnName(c);
+    arrow::ArrayVector chunks;
+    for (std::unique_ptr<arrow::ipc::feather::TableReader> &reader : readers) {
+      if (reader->GetColumnName(c) != name) {
+        return arrow::Status::Invalid("column " + std::to_string(c) + " is not " + name + " in every input");
+      }
+      std::shared_ptr<arrow::Column> column;
+      ARROW_RETURN_NOT_OK(reader->GetColumn(c, &column));
+      for (const std::shared_ptr<arrow::Array> &chunk : column->data()->chunks()) {
+        chunks.push_back(chunk);
+      }
+    }
+    std::shared_ptr<arrow::Array> values;
+    ARROW_RETURN_NOT_OK(arrow::Concatenate(chunks, arrow::default_memory_pool(), &values));
+    ARROW_RETURN_NOT_OK(writer->Append(name, *values));
+  }
+  ARROW_RETURN_NOT_OK(writer->Finalize());
+
+  return outfile->Close();
+}
+
+/*
+ * Function to compact outputs until none is left
+ */
+void *CompactOutputs(void *threadarg) {
+  struct compact_thread_args *args;
+  args = (struct compact_thread_args *) threadarg;
+
+  size_t o;
+  while (args->status.ok() && (o = (*args->next_output)++) < args->outputs->size()) {
+    const compact_output &output = args->outputs->at(o);
+    args->status = args->parquet ? compactParquet(output, args->row_group_rows, &args->num_copied, &args->num_reencoded)
+                                 : compactFeather(output);
+    if (!args->status.ok()) {
+      args->status = arrow::Status(args->status.code(), output.name + ": " + args->status.message());
+    }
+  }
+
+  pthread_exit(NULL);
+}
+
+int main(int argc, char **argv) {
+  // validating usage
+  if (argc < 4) {
+    std::cout << "Usage: ./compact <inputs> <output> <thread> [--target-size <MB>] [--row-group-rows <n>]" << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::string fin = argv[1], fout = argv[2], factor = argv[3];
+  std::map<std::string, std::string> options = parseOptions(argc, argv, 4);
+
+  // inputs are a glob list or @listfile of parts of one format
+  std::vector<std::string> files = expandBatchInputs(fin);
+  if (files.empty()) {
+    std::cout << "Error: no input" << std::endl;
+    return EXIT_FAILURE;
+  }
+  bool parquet = boost::algorithm::ends_with(files[0], ".parquet");
+  if (!parquet && !boost::algorithm::ends_with(files[0], ".feather")) {
+    std::cout << "Error: inputs must be .parquet or .feather files" << std::endl;
+    return EXIT_FAILURE;
+  }
+  for (const std::string &file : files) {
+    if (!boost::algorithm::ends_with(file, parquet ? ".parquet" : ".feather")) {
+      std::cout << "Error: " << file << " is not of the format of " << files[0] << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  int64_t target_bytes = (hasOption(options, "target-size") ? boost::lexical_cast<int64_t>(options["target-size"]) : 512) << 20;
+  int64_t row_group_rows = hasOption(options, "row-group-rows") ? boost::lexical_cast<int64_t>(options["row-group-rows"])
+                                                                : PARALLEL_ROW_GROUP_ROWS;
+  std::vector<compact_output> outputs = parquet ? groupBySize(files, target_bytes, "parquet/" + fout, ".parquet")
+                                                : groupBySize(files, target_bytes, "feather/" + fout, ".feather");
+
+  // an output must not truncate an input still to be read
+  for (const compact_output &output : outputs) {
+    struct stat output_stat;
+    if (stat(output.name.c_str(), &output_stat) != 0) {
+      continue;
+    }
+    for (const std::string &file : files) {
+      struct stat file_stat;
+      if (stat(file.c_str(), &file_stat) == 0 && file_stat.st_dev == output_stat.st_dev && file_stat.st_ino == output_stat.st_ino) {
+        std::cout << "Error: output " << output.name << " is also an input, choose another <output>" << std::endl;
+        return EXIT_FAILURE;
+      }
+    }
+  }
+
+  // every output is compacted by one thread
+  int num_thread = std::max(1, std::min<int>(boost::lexical_cast<int>(factor), outputs.size()));
+  std::atomic<size_t> next_output(0);
+  pthread_t thread_arr[num_thread];
+  compact_thread_args td[num_thread];
+  int rc;
+  for (int t=0; t<num_thread; t++) {
+    td[t].outputs = &outputs;
+    td[t].next_output = &next_output;
+    td[t].parquet = parquet;
+    td[t].row_group_rows = row_group_rows;
+    td[t].num_copied = 0;
+    td[t].num_reencoded = 0;
+    rc = pthread_create(&thread_arr[t], NULL, CompactOutputs, (void *)&td[t]);
+
+    if (rc) {
+      std::cout << "Error:unable to create thread," << rc << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  arrow::Status st;
+  int64_t num_copied = 0, num_reencoded = 0;
+  for (int t=0; t<num_thread; t++) {
+    rc = pthread_join(thread_arr[t], NULL);
+    if (rc) {
+      std::cout << "Error:unable to join, " << rc << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    if (!td[t].status.ok()) {
+      st = td[t].status;
+    }
+    num_copied += td[t].num_copied;
+    num_reencoded += td[t].num_reencoded;
+  }
+  if (!st.ok()) {
+    std::cout << "Error: " << st.ToString() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::cout << "Compact: " << files.size() << " inputs into " << outputs.size() << " outputs with " << num_thread << " threads";
+  if (parquet) {
+    std::cout << ", " << num_copied << " row groups copied, " << num_reencoded << " merged";
+  }
+  std::cout << std::endl;
+  return EXIT_SUCCESS;
+}
@@ -3,8 +3,14 @@
 #include <vector>
 #include <map>
 #include <fstream>
-
-#include "CSVReader.hpp"
+#include <pthread.h>
+
+#include "BatchScheduler.hpp"
+#include "MemoryBudget.hpp"
+#include "AsyncOutputStream.hpp"
+#include "ConverterOptions.hpp"
+#include "IPCSink.hpp"
+#include "ParallelParquetWriter.hpp"
 #include <arrow/api.h>
 #include <arrow/ipc/api.h>
 #include <arrow/io/api.h>
@@ -13,195 +19,160 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/lexical_cast.hpp>
 
-using arrow::Int32Builder;
-using arrow::FloatBuilder;
-using arrow::DoubleBuilder;
-using arrow::StringBuilder;
-using arrow::BooleanBuilder;
-
-typedef std::tuple<std::string,std::shared_ptr<arrow::DataType>> data_type_tup_t;
-
-arrow::Status csvToColumnarTable(
-  std::vector<std::vector<std::string>> csvData,
-  std::vector<data_type_tup_t> dataTypeVec,
-  std::shared_ptr<arrow::Table> &table) {
-  
-  arrow::MemoryPool *pool = arrow::default_memory_pool();
-
-  // make schema
-  std::vector<std::shared_ptr<arrow::Field>> schema_vector;
-  // determine the builders
-  std::vector<arrow::ArrayBuilder*> builders;
-  for (data_type_tup_t type : dataTypeVec) {
-    std::string first = std::get<0>(type);
-    std::shared_ptr<arrow::DataType> second = std::get<1>(type);
-    boost::trim(first);
-    
-    if (second->Equals(arrow::int32())) {
-      schema_vector.push_back(arrow::field(first, arrow::int32()));
-      builders.push_back(new Int32Builder(pool));
-    } else if (second->Equals(arrow::float32())) {
-      builders.push_back(new FloatBuilder(pool));
-      schema_vector.push_back(arrow::field(first, arrow::float32()));
-    } else if (second->Equals(arrow::float64())) {
-      builders.push_back(new DoubleBuilder(pool));
-      schema_vector.push_back(arrow::field(first, arrow::float64()));
-    } else if (second->Equals(arrow::utf8())) {
-      builders.push_back(new StringBuilder(pool));
-      schema_vector.push_back(arrow::field(first, arrow::utf8()));
-    } else if (second->Equals(arrow::boolean())) {
-      builders.push_back(new BooleanBuilder(pool));
-      schema_vector.push_back(arrow::field(first, arrow::boolean()));
-    }
-  }
-
-  // prepare string -> bool map
-  std::map<std::string, bool> str_bool_map = {
-    {"true", true}, {"false", false},
-    {"True", true}, {"False", false},
-    {"TRUE", true}, {"FALSE", false},
-    {"T", true}, {"F", false},
-    {"1", true}, {"0", false}
-  };
-
-  for (std::vector<std::string> row : csvData) {
-    int builderLen = builders.size();
-    for (int i=0; i<builderLen; i++) {
-      std::shared_ptr<arrow::DataType> dataType = std::get<1>(dataTypeVec.at(i));
-      std::string col = row.at(i);
-      boost::trim(col);
-      
-      if (dataType->Equals(arrow::int32())) {
-        dynamic_cast<Int32Builder*>( builders.at(i) )->Append(boost::lexical_cast<int>(col)); 
-      } else if (dataType->Equals(arrow::float32())) {
-        dynamic_cast<FloatBuilder*>( builders.at(i) )->Append(boost::lexical_cast<float>(col)); 
-      } else if (dataType->Equals(arrow::float64())) {
-        dynamic_cast<DoubleBuilder*>( builders.at(i) )->Append(boost::lexical_cast<double>(col)); 
-      } else if (dataType->Equals(arrow::utf8())) {
-        dynamic_cast<StringBuilder*>( builders.at(i) )->Append(col); 
-      } else if (dataType->Equals(arrow::boolean())) {
-        dynamic_cast<BooleanBuilder*>( builders.at(i) )->Append(str_bool_map.find(col)->second); 
-      }
-    }
-  }
-
-  // finalise arrays, declare schema and combine to arrays
-  arrow::ArrayVector arrVector;
-  std::vector<std::shared_ptr<arrow::Array>> array_array;
-  for (arrow::ArrayBuilder* builder : builders) {
-    std::shared_ptr<arrow::Array> arr;
-    array_array.push_back(arr);
-    builder->Finish(&arr);
-    arrVector.push_back(arr);
-  }
-
-  auto schema = std::make_shared<arrow::Schema>(schema_vector);
-  table = arrow::Table::Make(schema, arrVector);
-
-  return arrow::Status::OK();
+/*
+ * Function to make writer properties from the parse-time column stats:
+ * statistics on, dictionary encoding only for the columns whose values repeat
+ */
+std::shared_ptr<parquet::WriterProperties> writerPropertiesFromStats(const std::vector<ColumnStats> &stats) {
+  parquet::WriterProperties::Builder builder;
+  builder.enable_statistics();
+  for (const ColumnStats &colStats : stats) {
+    if (colStats.preferDictionary()) {
+      builder.enable_dictionary(colStats.getName());
+    } else {
+      builder.disable_dictionary(colStats.getName());
+    }
+  }
+  return builder.build();
 }
 
+/*
+ * Function to make the file key-value metadata carrying the column stats
+ */
+std::shared_ptr<arrow::KeyValueMetadata> columnStatsMetadata(const std::vector<ColumnStats> &stats) {
+  return std::make_shared<arrow::KeyValueMetadata>(std::vector<std::string>{"column_statistics"},
+                                                   std::vector<std::string>{columnStatsToJSON(stats)});
+}
 
-void printOutTable(const std::shared_ptr<arrow::Table> &table) {
-  int num_col = table->num_columns();
-  int num_row = table->num_rows();
+/*
+ * Function to write a table to parquet/<name>.parquet
+ */
+arrow::Status writeParquetFile(const std::shared_ptr<arrow::Table> &table, std::string name,
+                               std::shared_ptr<parquet::WriterProperties> properties) {
+  std::shared_ptr<arrow::io::OutputStream> outfile;
+  ARROW_RETURN_NOT_OK(openOutputStream("parquet/" + name + ".parquet", &outfile));
+  ARROW_RETURN_NOT_OK(parquet::arrow::WriteTable(*table, arrow::default_memory_pool(), outfile, table->num_rows(), properties));
 
-  // print cols name
-  std::vector<std::string> cols_name;
-  for (int i=0; i<num_col; i++) {
-    std::string col_name = table->column(i)->name();
-    std::cout << col_name << std::endl;
-    
-    std::shared_ptr<arrow::ChunkedArray> col_chunked_array = table->GetColumnByName(col_name)->data();
-    int num_chunk = col_chunked_array->num_chunks();
-    std::cout << "Num chunk: " << num_chunk << std::endl;
-    for (int j=0; j<num_chunk; j++) {
-      std::cout << col_chunked_array->chunk(j)->ToString() << std::endl;
+  return outfile->Close();
+}
+
+/*
+ * Function to write batches [first, last) of buffer to parquet/<name>.parquet, one row group each
+ */
+arrow::Status writeParquetBatches(std::string name, SpillBuffer &buffer, size_t first, size_t last,
+                                  const std::vector<ColumnStats> &stats) {
+  std::shared_ptr<arrow::io::OutputStream> outfile;
+  ARROW_RETURN_NOT_OK(openOutputStream("parquet/" + name + ".parquet", &outfile));
+
+  // the stats describe the whole input, a part carries only its encoding choices
+  std::unique_ptr<parquet::arrow::FileWriter> writer;
+  ARROW_RETURN_NOT_OK(parquet::arrow::FileWriter::Open(*buffer.getSchema(), buffer.getPool(), outfile,
+                                                       writerPropertiesFromStats(stats), &writer));
+  for (size_t i=first; i<last; i++) {
+    std::shared_ptr<arrow::RecordBatch> recordBatch;
+    ARROW_RETURN_NOT_OK(buffer.take(i, &recordBatch));
+    std::shared_ptr<arrow::Table> table;
+    ARROW_RETURN_NOT_OK(arrow::Table::FromRecordBatches({recordBatch}, &table));
+    ARROW_RETURN_NOT_OK(writer->WriteTable(*table, recordBatch->num_rows()));
+  }
+  ARROW_RETURN_NOT_OK(writer->Close());
+
+  return outfile->Close();
+}
+
+/*
+ * Function to write batches [first, last) of buffer as the single file parquet/<name>.parquet
+ *
+ * Batches are gathered into row groups of up to row_group_rows rows, or
+ * max_group_bytes, and the column chunks of each are encoded with factor threads.
+ */
+arrow::Status writeParquetBatchesSingleFile(std::string name, SpillBuffer &buffer, size_t first, size_t last,
+                                            int factor, int64_t row_group_rows, int64_t max_group_bytes,
+                                            const std::vector<ColumnStats> &stats) {
+  std::shared_ptr<arrow::io::OutputStream> outfile;
+  ARROW_RETURN_NOT_OK(openOutputStream("parquet/" + name + ".parquet", &outfile));
+
+  // the one output holds the whole input, so do its stats
+  std::shared_ptr<parquet::WriterProperties> properties = writerPropertiesFromStats(stats);
+  std::shared_ptr<arrow::Schema> schema = buffer.getSchema()->AddMetadata(columnStatsMetadata(stats));
+  std::shared_ptr<parquet::SchemaDescriptor> parquet_schema;
+  ARROW_RETURN_NOT_OK(parquet::arrow::ToParquetSchema(schema.get(), *properties, &parquet_schema));
+  ParquetChunkSerializer serializer(outfile.get());
+  ARROW_RETURN_NOT_OK(serializer.open(parquet_schema.get(), properties, schema->metadata()));
+
+  std::vector<std::shared_ptr<arrow::RecordBatch>> group;
+  int64_t group_rows = 0, group_bytes = 0;
+  for (size_t i=first; i<last; i++) {
+    std::shared_ptr<arrow::RecordBatch> recordBatch;
+    ARROW_RETURN_NOT_OK(buffer.take(i, &recordBatch));
+    group_rows += recordBatch->num_rows();
+    group_bytes += recordBatchBytes(recordBatch);
+    group.push_back(recordBatch);
+    if (group_rows >= row_group_rows || group_bytes >= max_group_bytes || i + 1 == last) {
+      std::shared_ptr<arrow::Table> table;
+      ARROW_RETURN_NOT_OK(arrow::Table::FromRecordBatches(group, &table));
+      group.clear();
+      ARROW_RETURN_NOT_OK(encodeTableParallel(table, &serializer, properties, row_group_rows, factor));
+      group_rows = 0;
+      group_bytes = 0;
     }
-    std::cout << std::endl;
   }
+  ARROW_RETURN_NOT_OK(serializer.close());
 
-  std::cout << "done" << std::endl;
+  std::cout << "Write: " << serializer.getNumRowGroup() << " row groups with " << std::max(factor, 1) << " threads" << std::endl;
+  return outfile->Close();
 }
 
 /*
- * Data Types file format:
- *  <type>, <type>, <type>
- * 
- * supported data type:
- *  - integer
- *  - float
- *  - double
- *  - string
- *  - boolean
+ * Function to write a table to the single file parquet/<name>.parquet, encoding its
+ * column chunks with factor threads
  */
-std::vector<data_type_tup_t> parseDataTypeString(std::string dataTypes, std::vector<std::string> header) {
-  std::vector<std::string> vec;
-  boost::algorithm::split(vec, dataTypes, boost::is_any_of(","));
-
-  assert(vec.size() == header.size());
-  std::vector<data_type_tup_t> dataTypeVec;
-  int headerLen = header.size();
-  for (int i=0; i<headerLen; i++) {
-    std::string type = vec.at(i);
-    std::string col_name = header.at(i);
-    if (type.compare("integer") == 0) {
-      dataTypeVec.push_back(std::make_tuple(col_name, arrow::int32()));
-    } else if (type.compare("float") == 0) {
-      dataTypeVec.push_back(std::make_tuple(col_name, arrow::float32()));
-    } else if (type.compare("double") == 0) {
-      dataTypeVec.push_back(std::make_tuple(col_name, arrow::float64()));
-    } else if (type.compare("string") == 0) {
-      dataTypeVec.push_back(std::make_tuple(col_name, arrow::utf8()));
-    } else if (type.compare("boolean") == 0) {
-      dataTypeVec.push_back(std::make_tuple(col_name, arrow::boolean()));
-    }
-  }
-
-  return dataTypeVec;
+arrow::Status writeParquetSingleFile(const std::shared_ptr<arrow::Table> &table, std::string name, int factor,
+                                     int64_t row_group_rows, std::shared_ptr<parquet::WriterProperties> properties) {
+  std::shared_ptr<arrow::io::OutputStream> outfile;
+  ARROW_RETURN_NOT_OK(openOutputStream("parquet/" + name + ".parquet", &outfile));
+  ARROW_RETURN_NOT_OK(writeParquetParallel(table, outfile.get(), properties, row_group_rows, factor));
+
+  return outfile->Close();
 }
 
 struct write_file_thread_args {
   int file_num;
   std::string filename;
   std::shared_ptr<arrow::Table> table;
+  std::shared_ptr<parquet::WriterProperties> properties;
+  arrow::Status status;
 };
 
 void *WriteFile(void *threadarg) {
   struct write_file_thread_args *args;
   args = (struct write_file_thread_args *) threadarg;
 
-  std::shared_ptr<arrow::io::FileOutputStream> outfile;
-  arrow::io::FileOutputStream::Open("parquet/" + args->filename + std::to_string(args->file_num) + ".parquet", &outfile);
-  parquet::arrow::WriteTable(*(args->table), arrow::default_memory_pool(), outfile, args->table->num_rows());
-
-  outfile->Close();
+  args->status = writeParquetFile(args->table, args->filename + std::to_string(args->file_num), args->properties);
 
   pthread_exit(NULL);
 }
 
-arrow::Status exportArrowToParquet(const std::shared_ptr<arrow::Table>& table, std::string filename, int factor) {
-  arrow::TableBatchReader tableBatchReader(*table);
+arrow::Status exportArrowToParquet(const std::shared_ptr<arrow::Table>& table, std::string filename, int factor,
+                                   std::shared_ptr<parquet::WriterProperties> properties) {
   int64_t table_row_num = table->num_rows();
 
   if (factor > table_row_num) {
     factor = table_row_num;
   }
   int64_t max_chunk_size = table_row_num / factor;
-  tableBatchReader.set_chunksize(max_chunk_size);
 
   pthread_t thread_arr[factor];
   write_file_thread_args td[factor];
-  std::vector<std::shared_ptr<arrow::RecordBatch>> temp_recordbatch = {
-    std::shared_ptr<arrow::RecordBatch>()
-  };
   int rc;
   for (uint f_idx=0; f_idx<factor; f_idx++) {
     td[f_idx].file_num = f_idx;
     td[f_idx].filename = filename;
+    td[f_idx].properties = properties;
     
-    tableBatchReader.ReadNext(&temp_recordbatch.at(0));
-    arrow::Table::FromRecordBatches(temp_recordbatch, &td[f_idx].table);
+    // the table comes in chunks, every part is a zero copy slice of it, the last one takes the rest
+    td[f_idx].table = table->Slice(f_idx * max_chunk_size,
+                                   f_idx == factor-1 ? table_row_num - f_idx * max_chunk_size : max_chunk_size);
 
     rc = pthread_create(&thread_arr[f_idx], NULL, WriteFile, (void *)&td[f_idx]);
 
@@ -211,44 +182,168 @@ arrow::Status exportArrowToParquet(const std::shared_ptr<arrow::Table>& table, s
     }
   }
 
-  void *status;
+  arrow::Status status;
   for (uint f_idx=0; f_idx<factor; f_idx++) {
-    rc = pthread_join(thread_arr[f_idx], &status);
+    rc = pthread_join(thread_arr[f_idx], NULL);
     if (rc) {
       std::cout << "Error:unable to join, " << rc << std::endl;
       exit(EXIT_FAILURE);
     }
 
     std::cout << "Write: completed thread id :" << f_idx;
-    std::cout << " exiting with status :" << status << std::endl;  
+    std::cout << " exiting with status :" << td[f_idx].status.ToString() << std::endl;
+    if (!td[f_idx].status.ok()) {
+      status = td[f_idx].status;
+    }
   }
-  
-  pthread_exit(NULL);
-  return arrow::Status::OK();  
+
+  return status;
 }
 
 int main(int argc, char **argv) {
   // validating usage
   if (argc < 5) {
-    std::cout << "Usage: ./csv2csv <input> <dataTypes> <output> <thread>" << std::endl;
+    std::cout << "Usage: ./csv2parquet <input> <dataTypes> <output> <thread> [--batch] [--merge <MB>] [--memory-limit <MB>] [--spill-dir <dir>] [--sort-by <col>,<col>] [--dedupe-on <col>,<col> [--keep first|last]] [--ipc-stream <path>|- | --ipc-shm <socket> [--shm-dir <dir>]] [--single-file [--row-group-rows <n>]]" << std::endl;
     return EXIT_FAILURE;
   }
   std::string fin = argv[1], dataTypes = argv[2], fout = argv[3], factor = argv[4];
+  // stdout carries an ipc stream to it, the messages go to stderr
+  if (streamsToStdout(argc, argv, 5)) {
+    std::cout.rdbuf(std::cerr.rdbuf());
+  }
+  std::map<std::string, std::string> options = parseOptions(argc, argv, 5);
+  bool keep_last = false;
+  if (!parseKeepLast(options, &keep_last).ok()) {
+    std::cout << "Error: --keep must be first or last" << std::endl;
+    return EXIT_FAILURE;
+  }
 
-  // import from csv
-  CSVReader reader(fin);
+  // streaming: batches go to consumers as they are parsed, no <output> file is written
+  std::unique_ptr<RecordBatchSink> sink = makeRecordBatchSink(options);
+  if (sink) {
+    if (hasOption(options, "sort-by") || hasOption(options, "dedupe-on")) {
+      std::cout << "Error: --sort-by and --dedupe-on need the whole input, they cannot stream" << std::endl;
+      return EXIT_FAILURE;
+    }
+    arrow::Status st = streamCSVToSink(fin, dataTypes, sink.get());
+    if (!st.ok()) {
+      std::cout << "Error: " << st.ToString() << std::endl;
+    }
+    return st.ok() ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  // batch: <input> is a glob list or @listfile sharing one worker pool
+  if (hasOption(options, "batch")) {
+    if (hasOption(options, "sort-by")) {
+      std::cout << "Error: --sort-by orders one input, it cannot be used with --batch" << std::endl;
+      return EXIT_FAILURE;
+    }
+    if (hasOption(options, "dedupe-on")) {
+      std::cout << "Error: --dedupe-on deduplicates one input, it cannot be used with --batch" << std::endl;
+      return EXIT_FAILURE;
+    }
+    if (hasOption(options, "single-file")) {
+      std::cout << "Error: --single-file writes one input to one file, it cannot be used with --batch" << std::endl;
+      return EXIT_FAILURE;
+    }
+    batch_write_fn_t write_fn = [](const std::shared_ptr<arrow::Table> &table, std::string name) {
+      return writeParquetFile(table, name, parquet::default_writer_properties());
+    };
+    arrow::Status st = convertBatch(fin, dataTypes, fout, boost::lexical_cast<int>(factor),
+                                    parseMergeBytes(options), write_fn);
+    return st.ok() ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  // memory budget: convert in record batches, spilling the oldest to disk when over budget
+  if (hasOption(options, "memory-limit")) {
+    int64_t limit_bytes = parseMemoryLimit(options);
+    std::vector<ColumnStats> stats;
+    part_write_fn_t write_fn = [&stats](std::string name, SpillBuffer &buffer, size_t first, size_t last) {
+      return writeParquetBatches(name, buffer, first, last, stats);
+    };
+    bool single_file = hasOption(options, "single-file");
+    if (single_file) {
+      // one part named <output>, row groups held in at most a quarter of the budget while encoded
+      int num_thread = boost::lexical_cast<int>(factor);
+      int64_t row_group_rows = hasOption(options, "row-group-rows") ? boost::lexical_cast<int64_t>(options["row-group-rows"])
+                                                                    : PARALLEL_ROW_GROUP_ROWS;
+      write_fn = [&stats, fout, num_thread, row_group_rows, limit_bytes](std::string name, SpillBuffer &buffer,
+                                                                        size_t first, size_t last) {
+        return writeParquetBatchesSingleFile(fout, buffer, first, last, num_thread, row_group_rows, limit_bytes / 4, stats);
+      };
+    }
+    arrow::Status st = convertWithinBudget(fin, dataTypes, fout, boost::lexical_cast<int>(factor),
+                                           limit_bytes, 0, parseSpillDir(options), write_fn, &stats,
+                                           options["sort-by"], options["dedupe-on"], keep_last, single_file);
+    if (st.ok()) {
+      st = writeColumnStatsSidecar("parquet/" + fout + ".stats.json", stats);
+    }
+    if (!st.ok()) {
+      std::cout << "Error: " << st.ToString() << std::endl;
+    }
+    return st.ok() ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  // import from csv, mapped in memory
+  MappedCSVReader reader(fin);
+  arrow::Status st = reader.open();
+  if (!st.ok()) {
+    std::cout << "Error: " << st.ToString() << std::endl;
+    return EXIT_FAILURE;
+  }
   std::vector<std::string> csvHeader = reader.getHeader();
-  std::vector<std::vector<std::string>> csvData = reader.getData();
 
   // convert to arrow
   std::vector<data_type_tup_t> dataTypeVec = parseDataTypeString(dataTypes, csvHeader);
+  std::vector<ColumnStats> stats = makeColumnStats(dataTypeVec);
   std::shared_ptr<arrow::Table> table;
-  csvToColumnarTable(csvData, dataTypeVec, table);
+  st = reader.readAll(dataTypeVec, table, arrow::default_memory_pool(), &stats);
+  if (!st.ok()) {
+    std::cout << "Error: " << st.ToString() << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (hasOption(options, "dedupe-on")) {
+    st = dedupeTable(table, options["dedupe-on"], keep_last, boost::lexical_cast<int>(factor), &table);
+    if (!st.ok()) {
+      std::cout << "Error: " << st.ToString() << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  if (hasOption(options, "sort-by")) {
+    st = sortTable(table, options["sort-by"], boost::lexical_cast<int>(factor), &table);
+    if (!st.ok()) {
+      std::cout << "Error: " << st.ToString() << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  st = writeColumnStatsSidecar("parquet/" + fout + ".stats.json", stats);
+  if (!st.ok()) {
+    std::cout << "Error: " << st.ToString() << std::endl;
+    return EXIT_FAILURE;
+  }
 
   // write out data
   printOutTable(table);
 
+  // single file: one output, its column chunks encoded in parallel
+  if (hasOption(options, "single-file")) {
+    int64_t row_group_rows = hasOption(options, "row-group-rows") ? boost::lexical_cast<int64_t>(options["row-group-rows"])
+                                                                  : PARALLEL_ROW_GROUP_ROWS;
+    // the one output holds the whole input, so do its stats
+    table = table->ReplaceSchemaMetadata(columnStatsMetadata(stats));
+    st = writeParquetSingleFile(table, fout, boost::lexical_cast<int>(factor), row_group_rows,
+                                writerPropertiesFromStats(stats));
+    if (!st.ok()) {
+      std::cout << "Error: " << st.ToString() << std::endl;
+    }
+    return st.ok() ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
   // export to parquet
-  exportArrowToParquet(table, fout, boost::lexical_cast<int>(factor));
+  st = exportArrowToParquet(table, fout, boost::lexical_cast<int>(factor), writerPropertiesFromStats(stats));
+  if (!st.ok()) {
+    std::cout << "Error: " << st.ToString() << std::endl;
+    return EXIT_FAILURE;
+  }
   return EXIT_SUCCESS;
 }
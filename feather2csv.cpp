@@ -0,0 +1,206 @@
+#include <cstdint>
+#include <iostream>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <cstdlib>
+#include <pthread.h>
+
+#include "CSVWriter.hpp"
+#include "AsyncOutputStream.hpp"
+#include "ConverterOptions.hpp"
+#include <arrow/api.h>
+#include <arrow/io/api.h>
+#include <arrow/ipc/api.h>
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+
+// rows formatted per piece of the output
+static const int64_t SLICE_ROWS = 1 << 16;
+
+struct read_column_thread_args {
+  std::string filename;
+  std::vector<int> *column_indices;
+  std::vector<std::shared_ptr<arrow::Column>> *columns;
+  std::atomic<size_t> *next_column;
+  arrow::Status status;
+};
+
+struct format_slice_thread_args {
+  std::shared_ptr<arrow::Table> table;
+  OrderedCSVOutput *output;
+  arrow::Status status;
+};
+
+arrow::Status openFeatherFile(std::string filename, std::unique_ptr<arrow::ipc::feather::TableReader> *reader) {
+  std::shared_ptr<arrow::io::MemoryMappedFile> infile;
+  ARROW_RETURN_NOT_OK(arrow::io::MemoryMappedFile::Open(filename, arrow::io::FileMode::READ, &infile));
+  return arrow::ipc::feather::TableReader::Open(infile, reader);
+}
+
+/*
+ * Function to decode selected columns until none is left
+ */
+void *ReadColumns(void *threadarg) {
+  struct read_column_thread_args *args;
+  args = (struct read_column_thread_args *) threadarg;
+
+  std::unique_ptr<arrow::ipc::feather::TableReader> reader;
+  args->status = openFeatherFile(args->filename, &reader);
+
+  size_t i;
+  while (args->status.ok() && (i = (*args->next_column)++) < args->column_indices->size()) {
+    args->status = reader->GetColumn(args->column_indices->at(i), &args->columns->at(i));
+  }
+
+  pthread_exit(NULL);
+}
+
+/*
+ * Function to format row slices as csv until none is left
+ */
+void *FormatSlices(void *threadarg) {
+  struct format_slice_thread_args *args;
+  args = (struct format_slice_thread_args *) threadarg;
+
+  CSVWriter writer;
+  int64_t slice;
+  while ((slice = args->output->nextPiece()) >= 0) {
+    std::string text = "";
+    if (args->status.ok()) {
+      args->status = writer.formatTable(args->table->Slice(slice * SLICE_ROWS, SLICE_ROWS), &text);
+    }
+    // always commit so that the following slices are not held back
+    args->output->commit(slice, text);
+  }
+
+  pthread_exit(NULL);
+}
+
+arrow::Status exportFeatherToCSV(std::string filename, std::string fout, int factor, std::string columns) {
+  std::unique_ptr<arrow::ipc::feather::TableReader> reader;
+  ARROW_RETURN_NOT_OK(openFeatherFile(filename, &reader));
+  if (factor < 1) {
+    factor = 1;
+  }
+
+  // resolve selected columns, all of them by default
+  std::vector<int> column_indices;
+  if (columns.empty()) {
+    for (int i=0; i<reader->num_columns(); i++) {
+      column_indices.push_back(i);
+    }
+  } else {
+    std::map<std::string, int> name_idx;
+    for (int i=0; i<reader->num_columns(); i++) {
+      name_idx[reader->GetColumnName(i)] = i;
+    }
+    std::vector<std::string> names;
+    boost::algorithm::split(names, columns, boost::is_any_of(","));
+    for (std::string name : names) {
+      boost::trim(name);
+      if (name_idx.find(name) == name_idx.end()) {
+        return arrow::Status::KeyError("no column " + name + " in " + filename);
+      }
+      column_indices.push_back(name_idx[name]);
+    }
+  }
+
+  // decode columns in parallel, each thread through its own reader of the mapped file
+  std::vector<std::shared_ptr<arrow::Column>> cols(column_indices.size());
+  std::atomic<size_t> next_column(0);
+  int num_reader = std::min<int>(factor, column_indices.size());
+  pthread_t read_thread_arr[num_reader];
+  read_column_thread_args read_td[num_reader];
+  int rc;
+  for (int t=0; t<num_reader; t++) {
+    read_td[t].filename = filename;
+    read_td[t].column_indices = &column_indices;
+    read_td[t].columns = &cols;
+    read_td[t].next_column = &next_column;
+    rc = pthread_create(&read_thread_arr[t], NULL, ReadColumns, (void *)&read_td[t]);
+
+    if (rc) {
+      std::cout << "Error:unable to create thread," << rc << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (int t=0; t<num_reader; t++) {
+    rc = pthread_join(read_thread_arr[t], NULL);
+    if (rc) {
+      std::cout << "Error:unable to join, " << rc << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    ARROW_RETURN_NOT_OK(read_td[t].status);
+  }
+
+  std::vector<std::shared_ptr<arrow::Field>> fields;
+  for (std::shared_ptr<arrow::Column> col : cols) {
+    fields.push_back(col->field());
+  }
+  std::shared_ptr<arrow::Table> table = arrow::Table::Make(arrow::schema(fields), cols, reader->num_rows());
+
+  std::shared_ptr<arrow::io::OutputStream> outcsv;
+  ARROW_RETURN_NOT_OK(openOutputStream("csv/" + fout + ".csv", &outcsv));
+  CSVWriter writer;
+  std::string header = writer.formatHeader(table->schema());
+  ARROW_RETURN_NOT_OK(outcsv->Write(header.data(), header.size()));
+
+  // format row slices in parallel, written in order
+  int64_t num_slice = (table->num_rows() + SLICE_ROWS - 1) / SLICE_ROWS;
+  OrderedCSVOutput output(outcsv.get(), num_slice, 2 * factor);
+
+  pthread_t thread_arr[factor];
+  format_slice_thread_args td[factor];
+  for (int t=0; t<factor; t++) {
+    td[t].table = table;
+    td[t].output = &output;
+    rc = pthread_create(&thread_arr[t], NULL, FormatSlices, (void *)&td[t]);
+
+    if (rc) {
+      std::cout << "Error:unable to create thread," << rc << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  arrow::Status status;
+  for (int t=0; t<factor; t++) {
+    rc = pthread_join(thread_arr[t], NULL);
+    if (rc) {
+      std::cout << "Error:unable to join, " << rc << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    if (!td[t].status.ok()) {
+      status = td[t].status;
+    }
+  }
+  if (status.ok()) {
+    status = output.getStatus();
+  }
+  ARROW_RETURN_NOT_OK(outcsv->Close());
+
+  std::cout << "Read: " << cols.size() << " columns, " << num_slice << " slices with " << factor << " threads" << std::endl;
+  return status;
+}
+
+int main(int argc, char **argv) {
+  // validating usage
+  if (argc < 4) {
+    std::cout << "Usage: ./feather2csv <input> <output> <thread> [--columns <col>,<col>]" << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::string fin = argv[1], fout = argv[2], factor = argv[3];
+  std::map<std::string, std::string> options = parseOptions(argc, argv, 4);
+
+  // export to csv
+  arrow::Status st = exportFeatherToCSV(fin, fout, boost::lexical_cast<int>(factor), options["columns"]);
+  if (!st.ok()) {
+    std::cout << "Error: " << st.ToString() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,155 @@
+#include <cstdint>
+#include <iostream>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <memory>
+#include <cstdlib>
+#include <pthread.h>
+
+#include "CSVWriter.hpp"
+#include "AsyncOutputStream.hpp"
+#include "ConverterOptions.hpp"
+#include <arrow/api.h>
+#include <arrow/io/api.h>
+#include <parquet/arrow/reader.h>
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+
+struct read_file_thread_args {
+  std::string filename;
+  std::vector<int> column_indices;
+  OrderedCSVOutput *output;
+  arrow::Status status;
+};
+
+arrow::Status openParquetFile(std::string filename, std::unique_ptr<parquet::arrow::FileReader> *reader) {
+  std::shared_ptr<arrow::io::MemoryMappedFile> infile;
+  ARROW_RETURN_NOT_OK(arrow::io::MemoryMappedFile::Open(filename, arrow::io::FileMode::READ, &infile));
+  return parquet::arrow::OpenFile(infile, arrow::default_memory_pool(), reader);
+}
+
+/*
+ * Function to decode row groups and format them as csv until none is left
+ */
+void *ReadRowGroups(void *threadarg) {
+  struct read_file_thread_args *args;
+  args = (struct read_file_thread_args *) threadarg;
+
+  // every thread decodes through its own reader of the mapped file
+  std::unique_ptr<parquet::arrow::FileReader> reader;
+  args->status = openParquetFile(args->filename, &reader);
+
+  CSVWriter writer;
+  int64_t row_group;
+  while ((row_group = args->output->nextPiece()) >= 0) {
+    std::string text = "";
+    if (args->status.ok()) {
+      std::shared_ptr<arrow::Table> table;
+      args->status = reader->ReadRowGroup(row_group, args->column_indices, &table);
+      if (args->status.ok()) {
+        args->status = writer.formatTable(table, &text);
+      }
+    }
+    // always commit so that the following row groups are not held back
+    args->output->commit(row_group, text);
+  }
+
+  pthread_exit(NULL);
+}
+
+arrow::Status exportParquetToCSV(std::string filename, std::string fout, int factor, std::string columns) {
+  std::unique_ptr<parquet::arrow::FileReader> reader;
+  ARROW_RETURN_NOT_OK(openParquetFile(filename, &reader));
+
+  std::shared_ptr<arrow::Schema> schema;
+  ARROW_RETURN_NOT_OK(reader->GetSchema(&schema));
+
+  // resolve selected columns, all of them by default
+  std::vector<int> column_indices;
+  if (columns.empty()) {
+    for (int i=0; i<schema->num_fields(); i++) {
+      column_indices.push_back(i);
+    }
+  } else {
+    std::vector<std::string> names;
+    boost::algorithm::split(names, columns, boost::is_any_of(","));
+    for (std::string name : names) {
+      boost::trim(name);
+      int idx = schema->GetFieldIndex(name);
+      if (idx < 0) {
+        return arrow::Status::KeyError("no column " + name + " in " + filename);
+      }
+      column_indices.push_back(idx);
+    }
+  }
+  std::vector<std::shared_ptr<arrow::Field>> fields;
+  for (int idx : column_indices) {
+    fields.push_back(schema->field(idx));
+  }
+
+  std::shared_ptr<arrow::io::OutputStream> outcsv;
+  ARROW_RETURN_NOT_OK(openOutputStream("csv/" + fout + ".csv", &outcsv));
+  CSVWriter writer;
+  std::string header = writer.formatHeader(arrow::schema(fields));
+  ARROW_RETURN_NOT_OK(outcsv->Write(header.data(), header.size()));
+
+  int num_row_group = reader->num_row_groups();
+  if (factor < 1) {
+    factor = 1;
+  }
+  OrderedCSVOutput output(outcsv.get(), num_row_group, 2 * factor);
+
+  pthread_t thread_arr[factor];
+  read_file_thread_args td[factor];
+  int rc;
+  for (int t=0; t<factor; t++) {
+    td[t].filename = filename;
+    td[t].column_indices = column_indices;
+    td[t].output = &output;
+    rc = pthread_create(&thread_arr[t], NULL, ReadRowGroups, (void *)&td[t]);
+
+    if (rc) {
+      std::cout << "Error:unable to create thread," << rc << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  arrow::Status status;
+  for (int t=0; t<factor; t++) {
+    rc = pthread_join(thread_arr[t], NULL);
+    if (rc) {
+      std::cout << "Error:unable to join, " << rc << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    if (!td[t].status.ok()) {
+      status = td[t].status;
+    }
+  }
+  if (status.ok()) {
+    status = output.getStatus();
+  }
+  ARROW_RETURN_NOT_OK(outcsv->Close());
+
+  std::cout << "Read: " << num_row_group << " row groups with " << factor << " threads" << std::endl;
+  return status;
+}
+
+int main(int argc, char **argv) {
+  // validating usage
+  if (argc < 4) {
+    std::cout << "Usage: ./parquet2csv <input> <output> <thread> [--columns <col>,<col>]" << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::string fin = argv[1], fout = argv[2], factor = argv[3];
+  std::map<std::string, std::string> options = parseOptions(argc, argv, 4);
+
+  // export to csv
+  arrow::Status st = exportParquetToCSV(fin, fout, boost::lexical_cast<int>(factor), options["columns"]);
+  if (!st.ok()) {
+    std::cout << "Error: " << st.ToString() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}